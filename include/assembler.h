@@ -5,47 +5,7 @@
 #include <string>
 
 #include "dcpu16.h"
-
-static const char ins_set[4*16*3+1] =
-	"000JSR...............HCFINTIAGIASRFIIAQ........."
-	"HWNHWQHWI......................................."
-	"nbiSETADDSUBMULMLIDIVDVIMODMDIANDBORXORSHRASRSHL"
-	"IFBIFCIFEIFNIFGIFAIFLIFU......ADXSBX......STISTD";
-
-/* Disassemble() produces textual disassembly of single DCPU instruction at memory[pc] */
-static std::unordered_multimap<uint32_t, std::string> SymbolLookup;
-
-static const bool DisassemblyListing = false;
-
-static const char regnames[][5] = {"A","B","C","X","Y","Z","I","J","PC","SP","EX","IA"};
-
-static std::string Disassemble(unsigned pc, const uint16_t* memory)
-{
-	unsigned v = memory[pc++], o = (v & 0x1F), bb = (v>>5) & 0x1F, aa = (v>>10) & 0x3F;
-
-	std::string opcode(&ins_set[3*(o ? 32+o : bb)], 3);
-	auto doparam = [&](char which, unsigned v) -> std::string
-	{
-		std::string result(" ");
-		char Buf[32], sep[4] = "\0+ ";
-		if(v == 0x18) return result + (which=='b' ? "PUSH" : "POP");
-		if(v >= 0x20) { std::sprintf(Buf, " 0x%X", uint16_t(int(v)-0x21)); return Buf; }
-		if(reg_specs[v] & MEM) result += '[';
-		if((reg_specs[v] & 0xFu)!=NOREG) { result += regnames[(reg_specs[v] & 0xFu)]; sep[0] = ' '; }
-		if(reg_specs[v] & IMM) { sprintf(Buf, "%s0x%X", sep, memory[pc++]); result += Buf; }
-		if(reg_specs[v] & IMM)
-			for(auto i = SymbolLookup.equal_range(memory[pc-1]); i.first != i.second; ++i.first)
-				result += "=" + i.first->second;
-		if(reg_specs[v] & MEM) result += ']';
-		return result;
-	};
-	for(auto i = SymbolLookup.equal_range(pc-1); i.first != i.second; ++i.first)
-		opcode = i.first->second + ": " + opcode;
-
-	std::string aparam = doparam('a', aa);
-	if(o) { opcode += doparam('b', bb); opcode += ','; }
-	return opcode += aparam;
-}
+#include "disassembler.h"
 
 class Assembler
 {
@@ -63,6 +23,8 @@ class Assembler
 	std::unordered_map<std::string, std::pair<std::string,std::vector<std::string>>> macros;
 	// Macro call: Macro name, list of parameter values
 	std::pair<std::string,std::vector<std::string>> macro_call;
+	// Produce a side-by-side disassembly & source code listing on stderr.
+	bool listing;
 
 	/* Define all reserved words */
 	std::unordered_map<std::string, uint16_t> bops, operands;
@@ -289,7 +251,6 @@ class Assembler
 			{
 				if(!symbols.insert( {id,pc} ).second)
 					std::fprintf(stderr, "Error: Duplicate definition of '%s'\n", id.c_str());
-				SymbolLookup.insert( {pc,id} );
 
 				flush_operands();
 				label = false;
@@ -302,7 +263,7 @@ class Assembler
 				{
 					// Yes. Place the opcode into the memory.
 					flush_operands();
-					if(DisassemblyListing) pclist.emplace_back( pc,"" );
+					if(listing) pclist.emplace_back( pc,"" );
 					auto b = ib->second; // This is an index of a string in ins_set[]
 					dat = b == 0;
 					op.addr  = pc;
@@ -330,7 +291,7 @@ class Assembler
 		for(a=0; a<b; )
 		{
 			char c = std::toupper(code[a]);
-			if(DisassemblyListing) { line += code.substr(p,a+1-p - (c=='\n'||c=='\r')); p=a+1; }
+			if(listing) { line += code.substr(p,a+1-p - (c=='\n'||c=='\r')); p=a+1; }
 			// Newline flushes the current line, and ends any comment
 			if(c == '\n' || c == '\r')
 			{
@@ -345,7 +306,7 @@ class Assembler
 				if(in_meta == "MACRO") in_meta.clear();
 				parse_code(flush_id());
 				flush_operands();
-				if(DisassemblyListing && !pclist.empty()) { pclist.back().second += "||" + line; line.clear(); }
+				if(listing && !pclist.empty()) { pclist.back().second += "||" + line; line.clear(); }
 				comment=false; string=false; ++a; continue;
 			}
 			// The assembler will skip source code comments
@@ -434,7 +395,7 @@ class Assembler
 		}
 	}
 public:
-	explicit Assembler(const std::string& file_contents) : memory(0x10000)
+	explicit Assembler(const std::string& file_contents, bool listing = false) : memory(0x10000), listing(listing)
 	{
 		// Build the list of reserved words.
 		//   Instructions:
@@ -458,23 +419,33 @@ public:
 		for(auto&& r: forward_declarations)
 			memory[r.first] += simplify_expression(r.second, true).first;
 
-		if(DisassemblyListing)
+		if(listing)
 		{
 			pclist.emplace_back( pc,"" );
 
+			Disassembler disasm(&memory[0], symbols);
+			std::vector<char> text(disasm.maxText() + 1);
+			decltype(pclist)::value_type prev;
+
 			for(auto pcp: pclist)
 			{
-				static decltype(pcp) prev;
 				int len = std::fprintf(stderr, "%04X: ", prev.first);
-				std::string opcode, s = Disassemble(prev.first, &memory[0]);;
-				for(unsigned p=prev.first; p<pcp.first; opcode=s)
+				std::string opcode(&text[0], disasm.instruction((uint16_t)prev.first, &text[0]));
+				if(prev.first >= pcp.first) opcode.clear();
+				for(unsigned p=prev.first; p<pcp.first; )
 					len += std::fprintf(stderr, " %04X", memory[p++]);
-				std::fprintf(stderr, "%*s %16s %s\n",
-					40-len,"", opcode.c_str(), prev.second.c_str());
+				// Static cycle estimate, not counting a failed IF's skip
+				char cost[8] = "";
+				if(!opcode.empty()) std::snprintf(cost, sizeof(cost), "%u", instruction_cycles(memory[prev.first]));
+				std::fprintf(stderr, "%*s %2s %16s %s\n",
+					40-len,"", cost, opcode.c_str(), prev.second.c_str());
 				prev.swap(pcp);
 			}
 		}
 	}
 
+	// Known labels (name -> address), e.g. for a Disassembler. Read before taking the memory image.
+	const std::unordered_map<std::string, sint32>& labels() const { return symbols; }
+
 	operator std::vector<uint16_t>() && { return std::move(memory); }
 };
\ No newline at end of file
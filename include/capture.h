@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "lem1802.h"
+#include "ring.h"
+
+// Frame helpers, shared with dcpu-viewer
+void toRgb(const uint8_t* pixels, std::vector<uint8_t>& rgb); // LEM1802 pixels to RGB24
+uint64_t frameHash(const std::vector<uint8_t>& rgb);         // FNV-1a, like dcpu-batch's memory hash
+bool writePng(const std::string& path, const std::vector<uint8_t>& rgb);
+
+// Records LEM1802 frames without a window. The CPU thread only copies each frame into a free slot;
+// a background thread converts, hashes and writes them. When no slot is free the frame is dropped
+// and counted, unless the capture is lossless, in which case the CPU waits for the encoder.
+//
+// Formats: RAW (RGB24 frames back to back), Y4M (4:4:4, 60 fps) or PNG (one file per frame, named
+// <path>NNNNNN.png after the frame number, stored uncompressed). With deduplication a frame identical
+// to the one before is not written again. The hash log gets a line per frame that reaches the
+// encoder: "<frame> <cycle> <FNV-1a 64 of the RGB24 pixels>", plus " =" when it repeats the last one.
+class Capture : public FrameSink
+{
+public:
+	enum Format { NONE, RAW, Y4M, PNG };
+
+	struct Options
+	{
+		Format format = NONE;
+		std::string path, hashLog;
+		bool dedup = false, lossless = false;
+		size_t slots = 16; // frames the encoder may fall behind by (a power of two)
+	};
+
+private:
+	struct Slot
+	{
+		uint64_t number, cycle;
+		std::vector<uint8_t> pixels;
+	};
+
+	Options options;
+	std::vector<Slot> slots;
+	SpscRing<uint32_t> queued, unused; // slot indices: to the encoder, and back
+	FILE* out = nullptr;
+	FILE* log = nullptr;
+	bool failed = false;
+
+	std::thread encoder;
+	std::mutex lock;
+	std::condition_variable wakeup;
+	std::atomic<bool> waiting{false}; // the encoder is asleep, or about to be
+	bool stopping = false;            // under lock
+
+	std::atomic<uint64_t> received{0}, dropped{0};
+	uint64_t written = 0, repeated = 0; // encoder thread only
+
+	std::vector<uint8_t> rgb, previous;
+
+	void encode();
+	void write(const Slot& slot);
+	void writeY4m();
+
+public:
+	explicit Capture(const Options& options);
+	~Capture() { close(); }
+
+	// Writes out the frames still queued and closes the files. Call once no more frames can arrive.
+	void close();
+
+	// False if an output file could not be opened or, once closed, written
+	bool ok() const { return !failed; }
+
+	void frame(const ScreenState& state, const uint8_t* pixels, uint64_t number, uint64_t cycle) override;
+
+	// "raw", "y4m" or "png"
+	static Format parseFormat(const std::string& name);
+
+	// Received and dropped may be read at any time, written and repeated once closed
+	uint64_t framesReceived() const { return received.load(std::memory_order_relaxed); }
+	uint64_t framesDropped() const { return dropped.load(std::memory_order_relaxed); }
+	uint64_t framesWritten() const { return written; }
+	uint64_t framesRepeated() const { return repeated; }
+};
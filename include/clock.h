@@ -1,15 +1,20 @@
+#pragma once
+
 #include "hardware.h"
 
 class Clock : public Hardware
 {
 private:
-    uint32_t divider;
-    uint16_t counter;
-    uint32_t cycles;
+    uint64_t start;    // CPU cycle at which the clock was last programmed
+    uint32_t divider;  // 3 * CPU cycles per clock tick (0: stopped)
+    uint64_t fired;    // ticks already signalled with an interrupt
+
+    uint64_t ticks() const;
+    void reschedule();
 
 public:
-    Clock(DCPU16* c) : Hardware(c, 0x12d0b402, 1, 0), divider(0), counter(0), cycles(0) {}
+    Clock(DCPU16* c) : Hardware(c, 0x12d0b402, 1, 0), start(0), divider(0), fired(0) { ticking = false; }
 
     void interrupt() override;
-    void tick() override;
-};
\ No newline at end of file
+    void wake() override;
+};
@@ -1,21 +1,36 @@
 // DCPU-16 v1.7 emulator
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
 #include <cstdio>
+#include <memory>
+#include <mutex>
 #include <vector>
 
+#include "pages.h"
+#include "ring.h"
+
 #define MEM		0x80
 #define IMM		0x40
 #define NOREG	0x0F
 
+#ifdef _MSC_VER
+#define FORCE_INLINE __forceinline
+#else
+#define FORCE_INLINE __attribute__((always_inline)) inline
+#endif
+
 typedef signed short sint16;
 typedef signed int sint32;
 
 enum REGISTERS { A, B, C, X, Y, Z, I, J, PC, SP, EX, IA };
 enum INSTR { NBI, SET, ADD, SUB, MUL, MLI, DIV, DVI, MOD, MDI, AND, BOR, XOR, SHR, ASR, SHL, IFB, IFC, IFE, IFN, IFG, IFA, IFL, IFU, ADX = 0x1a, SBX, STI = 0x1e, STD };
-enum NBI { JSR = 0x01, INT = 0x08, IAG, IAS, RFI, IAQ, HWN = 0x10, HWQ, HWI };
+enum NBI { JSR = 0x01, HCF = 0x07, INT, IAG, IAS, RFI, IAQ, HWN = 0x10, HWQ, HWI };
 
-static const uint8_t reg_specs[0x20] =
+static constexpr uint8_t reg_specs[0x20] =
 	{
 		A             , B             , C             , X             , Y             , Z             , I                , J                , // regs
 		A        | MEM, B        | MEM, C        | MEM, X        | MEM, Y        | MEM, Z        | MEM, I           | MEM, J           | MEM,
@@ -23,40 +38,176 @@ static const uint8_t reg_specs[0x20] =
 		SP            , SP       | MEM, SP | IMM | MEM, SP            , PC            , EX            , NOREG | IMM | MEM, NOREG | IMM
 	};
 
+// Cycles taken by each basic and special opcode, not counting the next words read by operands
+static constexpr uint8_t basic_cycles[0x20] =
+	{
+		0, 1, 2, 2, 2, 2, 3, 3, 3, 3, 1, 1, 1, 1, 1, 1, // NBI SET ADD SUB MUL MLI DIV DVI MOD MDI AND BOR XOR SHR ASR SHL
+		2, 2, 2, 2, 2, 2, 2, 2, 0, 0, 3, 3, 0, 0, 2, 2  // IFB IFC IFE IFN IFG IFA IFL IFU ... ADX SBX ... STI STD
+	};
+
+static constexpr uint8_t special_cycles[0x20] =
+	{
+		0, 3, 0, 0, 0, 0, 0, 9, 4, 1, 1, 3, 2, 0, 0, 0, // ... JSR ... HCF INT IAG IAS RFI IAQ
+		2, 4, 4, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0  // HWN HWQ HWI
+	};
+
+// Operands cost one cycle per next word they read
+constexpr unsigned operand_cycles(unsigned v) { return v < 0x20 && (reg_specs[v] & IMM) ? 1 : 0; }
+
+// Static cost of an instruction, given its first word. A failed IF adds the cost of skipping:
+// the next words of each skipped instruction, plus one per skipped IF.
+constexpr unsigned instruction_cycles(uint16_t inst)
+{
+	return (inst & 0x1F) ? basic_cycles[inst & 0x1F] + operand_cycles((inst >> 10) & 0x3F) + operand_cycles((inst >> 5) & 0x1F)
+	                     : special_cycles[(inst >> 5) & 0x1F] + operand_cycles((inst >> 10) & 0x3F);
+}
+
+static const char ins_set[4*16*3+1] =
+	"000JSR...............HCFINTIAGIASRFIIAQ........."
+	"HWNHWQHWI......................................."
+	"nbiSETADDSUBMULMLIDIVDVIMODMDIANDBORXORSHRASRSHL"
+	"IFBIFCIFEIFNIFGIFAIFLIFU......ADXSBX......STISTD";
+
+static const char regnames[][5] = {"A","B","C","X","Y","Z","I","J","PC","SP","EX","IA"};
+
 class Hardware;
+class Metrics;
 
 class DCPU16
 {
 private:
 	uint16_t reg[12] = {};
-	uint16_t* mem;
-	uint16_t irqQueue[256];
-	uint8_t irqHead = 0, irqTail = 0;
-	std::vector<Hardware*> hardware;
+	uint16_t lit[2] = {}; // scratch storage for literal operands (a, b)
+
+	// Guest memory, 256 pages of 256 words. A page is shared until its first write: the zero page, or a
+	// page of the program image that every CPU running the same program maps. The first write swaps in
+	// a private copy, so reads are always one load through the table.
+	uint16_t* page[0x100];
+	uint8_t dirty[0x100] = {}; // pages with a private copy: written since the last reset()
+	std::shared_ptr<const PageImage> image;
+	std::vector<uint16_t*> spares; // private pages given back by reset(), for the next writes
+	unsigned copies = 0; // pages copied so far, for execute() to notice devices' writes mid-instruction
+	std::vector<Hardware*> hardware, tickers;
+	std::vector<std::pair<uint64_t, Hardware*>> timers; // pending wake-ups (cycle, device)
+	std::atomic<uint64_t> cycle{0}; // written by the CPU thread only, read by devices' threads
+	uint64_t nextTimer = UINT64_MAX;
+	uint64_t fusedPairs = 0;
+	uint64_t retired = 0, triggered = 0; // instructions executed, interrupts taken
 	bool irqQueuing = false;
-	bool running = true;
+	std::atomic<bool> running{true};
+	Metrics* metrics = nullptr;
+
+	// Interrupts waiting to be triggered, with the cycle each one arrived at. Any thread may post;
+	// the queue holds 256 like the hardware's, and overflowing it sets the DCPU-16 on fire.
+	struct Irq
+	{
+		uint16_t message;
+		uint64_t cycle;
+	};
+
+	MpscRing<Irq> irqs{256};
+	std::atomic<bool> burning{false};
+
+	// For sleepUntil(): interrupts posted while the CPU thread sleeps wake it up
+	std::mutex sleepLock;
+	std::condition_variable sleeper;
+	std::atomic<bool> sleeping{false};
+
+	void map(const std::vector<uint16_t>& prog);
+	void copyOnWrite(unsigned p);
+
+	// For reading only: the word may be in a shared page
+	uint16_t& word(uint16_t address) { return page[address >> 8][address & 0xFF]; }
 
 	void tick(unsigned int n = 1);
+	void wake();
+	void catchFire(const char* why);
+	void rouse();
 
 	template<char tag>
-	uint16_t& value(uint16_t val, bool skipping = false);
+	uint16_t& value(uint16_t val, bool skipping = false, bool writing = false);
+	uint16_t* reread(uint16_t val, uint16_t* operand, unsigned which);
 
-	void execute(bool skipping = false);
+	uint16_t execute(bool skipping = false); // returns the instruction word
+	void service();
+	bool fuse(unsigned shape);
 
 	friend class Hardware;
 	friend class LEM1802;
 	friend class Keyboard;
 	friend class Clock;
+	friend class PerfCounter;
+	friend class Mailbox;
+	friend class M35FD;
+	friend struct Recompiled;
+	friend class Lockstep;
 
 public:
 	DCPU16(std::vector<uint16_t> prog);
 	~DCPU16();
 
-	void installHardware(Hardware* hw) { hardware.push_back(hw); }
+	static const unsigned PageWords = PageImage::PageWords;
+
+	void installHardware(Hardware* hw);
+
+	// Back to the power-on state with `prog` loaded, as if newly constructed. Only the pages written
+	// since the last reset are given back, so a small job on a reused CPU costs a few microseconds.
+	// Only for CPUs with no devices installed: devices' state and wake-ups count from the cycles being
+	// zeroed. Call it only while the CPU is stopped.
+	void reset(const std::vector<uint16_t>& prog);
+
+	uint16_t read(uint16_t address) const { return page[address >> 8][address & 0xFF]; }
+
+	// A word about to be written: its page is copied out of the shared image first if need be
+	uint16_t& writable(uint16_t address)
+	{
+		if(!dirty[address >> 8]) copyOnWrite(address >> 8);
+		return word(address);
+	}
+
+	// Writes guest memory on behalf of a device
+	void store(uint16_t address, uint16_t value) { writable(address) = value; }
+
+	// Pages this CPU has its own copy of; the rest are shared
+	unsigned dirtyPages() const;
 
+	// Telemetry is collected while attached (nullptr detaches); see metrics.h
+	void attachMetrics(Metrics* m) { metrics = m; }
+
+	// Calls hw->wake() once the cycle counter reaches `at` (UINT64_MAX cancels)
+	void schedule(Hardware* hw, uint64_t at);
+
+	// Software interrupts (from_hardware = false) come from the CPU thread itself; hardware ones may
+	// be posted from any thread and are queued until the CPU gets to them
 	void interrupt(uint16_t a, bool from_hardware = false);
 
+	// Blocks the CPU thread until `deadline`, or until an interrupt it can take is posted or the CPU halts.
+	// Devices pace emulation with this, so input is never held up behind a frame delay.
+	void sleepUntil(std::chrono::steady_clock::time_point deadline);
+
 	void run();
 	void halt();
+
+	// Executes one instruction, and returns 1. If the cycle count is still below `until` after it, and
+	// no interrupt is waiting to be triggered, a second instruction that forms a common pair with the
+	// first (see fuses()) may run in the same dispatch: then it returns 2. The result is exactly that of
+	// stepping twice, so callers with a cycle budget pass it as `until`.
+	unsigned step(uint64_t until = 0);
+
+	// Whether step() runs `second` in one dispatch with `first` before it
+	static bool fuses(uint16_t first, uint16_t second);
+
+	// Instructions that ran as the second half of a fused pair: dispatches saved
+	uint64_t fused() const { return fusedPairs; }
+
+	// Since the last reset: instructions executed (skipped ones excluded), and interrupts that entered
+	// the handler at IA
+	uint64_t instructions() const { return retired; }
+	uint64_t interruptsTaken() const { return triggered; }
+
+	bool isRunning() const { return running.load(std::memory_order_relaxed); }
+	uint64_t cycles() const { return cycle.load(std::memory_order_relaxed); }
+	const uint16_t* registers() const { return reg; }
+
 	void dump();
 };
\ No newline at end of file
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "dcpu16.h"
+
+/* Disassembler decodes memory ranges into caller-provided buffers. Labels are kept in a sorted
+   index (plus a bitmap for quick rejection), so decoding does no per-instruction allocations. */
+class Disassembler
+{
+private:
+	const uint16_t* mem;
+	std::vector<std::pair<uint16_t, std::string>> labels; // sorted by address, aliases joined with '='
+	uint64_t labelled[0x10000 / 64] = {};
+	size_t longest = 0;
+
+	const std::string* label(uint16_t addr) const;
+	char* operand(char* p, char which, unsigned v, uint16_t& pc) const;
+
+public:
+	Disassembler(const uint16_t* memory, const std::unordered_map<std::string, sint32>& symbols = {});
+
+	// Number of words taken by an instruction, given its first word
+	static unsigned length(uint16_t inst);
+
+	// Worst-case sizes of an instruction() text and of a list() line
+	size_t maxText() const { return 48 + 3 * longest; }
+	size_t maxLine() const { return 24 + maxText(); }
+
+	// Writes the disassembly of the instruction at pc (not NUL-terminated) and returns its length.
+	size_t instruction(uint16_t pc, char* out) const;
+
+	// Writes listing lines for [pc, end) until out is full. Advances pc; returns the bytes written.
+	size_t list(uint32_t& pc, uint32_t end, char* out, size_t capacity) const;
+};
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <functional>
+
+class DCPU16;
+class Window;
+class Keyboard;
+
+// Runs `emulate` on its own thread while this (the main) thread waits on SDL events: key presses go
+// straight to the keyboard, frames to the window. Returns once the CPU halts or the window is closed.
+void runInteractive(DCPU16& cpu, Window* screen, Keyboard* keyboard, const std::function<void()>& emulate);
@@ -10,13 +10,19 @@ protected:
 	DCPU16* cpu;
 	uint32_t id, manufacturer;
 	uint16_t version, irq;
+	bool ticking = true; // needs tick() as CPU cycles elapse
 
 	Hardware(DCPU16* c, uint32_t id, uint16_t ver, uint32_t man) : cpu(c), id(id), manufacturer(man), version(ver), irq(0) {}
 
+	friend class DCPU16;
+
 public:
 	virtual ~Hardware() = default;
 	virtual void interrupt() {}
-	virtual void tick() {}
+	// Called with the cycles each instruction took, for devices that are `ticking`. Recompiled code
+	// runs none of a CPU's instructions while it has one, so prefer DCPU16::schedule().
+	virtual void tick(unsigned int) {}
+	virtual void wake() {} // the cycle requested with DCPU16::schedule() was reached
 
 	void query()
 	{
@@ -1,23 +1,29 @@
 #pragma once
 
+#include <atomic>
+
 #include <SDL2/SDL.h>
 
 #include "hardware.h"
+#include "ring.h"
 
+// Generic keyboard. Keys arrive on the input thread through post() and are delivered to the guest
+// as interrupts right away, however fast or slow the emulation is running.
 class Keyboard : public Hardware
 {
 private:
-	uint8_t buffer[0x100];
-	uint8_t state[0x100];
-	uint8_t bufhead = 0, buftail = 0;
-	unsigned int counter = 0; // tick counter
+	SpscRing<uint8_t> buffer{0x100};  // typed keys: pushed by the input thread, popped by the CPU
+	std::atomic<bool> state[0x100];   // keys held down
+	std::atomic<uint16_t> message{0}; // interrupt message (0: off)
 
 	// Translate SDL key symbol into DCPU key code.
 	static uint8_t translate(const SDL_Keysym& key);
 
 public:
-	Keyboard(DCPU16* c) : Hardware(c, 0x30cf7406, 1, 0) { }
+	Keyboard(DCPU16* c);
+
+	// Called from the input thread for every key press or release
+	void post(const SDL_Keysym& key, bool down);
 
-	void tick() override;
 	void interrupt() override;
-};
\ No newline at end of file
+};
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <chrono>
+#include <cstdint>
 #include <vector>
 
 #include "hardware.h"
@@ -8,19 +10,42 @@
 #define SCREEN_HEIGHT 	96
 #define SCALE 			4
 
-struct SDL_Window;
-struct SDL_Renderer;
-struct SDL_Texture;
+// Everything a LEM1802 frame is drawn from, as read from guest memory at the start of the frame
+struct ScreenState
+{
+	uint16_t vram[32 * 12];
+	uint16_t font[256];
+	uint16_t palette[16];
+	uint16_t border;
+	uint16_t blink; // nonzero while blinking cells show their background
+};
+
+// Gets every frame the LEM1802 draws, on the CPU thread, which it must not hold up
+class FrameSink
+{
+public:
+	virtual ~FrameSink() = default;
 
+	// False if frame() only looks at the state: the LEM1802 does not rasterize for sinks like that
+	virtual bool wantsPixels() const { return true; }
+
+	// SCREEN_WIDTH x SCREEN_HEIGHT pixels of 4 bytes (blue, green, red, 0xFF), or nullptr when no sink wants
+	// them; `number` counts frames from 0
+	virtual void frame(const ScreenState& state, const uint8_t* pixels, uint64_t number, uint64_t cycle) = 0;
+};
+
+// The screen itself needs no window: frames go to whatever sinks are attached (see window.h, capture.h)
 class LEM1802 : public Hardware
 {
 private:
-	SDL_Window* window;
-	SDL_Renderer* renderer;
-	SDL_Texture* texture;
-	std::vector<unsigned char> pixels;
-	unsigned int counter; // cycle counter
-	uint16_t ramBase;
+	ScreenState state;
+	std::vector<uint8_t> pixels;
+	std::vector<FrameSink*> sinks;
+	bool rasterizing = false;
+	uint64_t frames = 0;
+	std::chrono::steady_clock::time_point deadline; // when the current frame's delay is up
+	uint64_t start; // CPU cycle the screen was switched on at
+	uint16_t ramBase = 0;
 	uint16_t fontBase = 0;
 	uint16_t paletteBase = 0;
 	uint16_t borderColor = 0;
@@ -28,14 +53,21 @@ private:
 	uint16_t delay;
 
 	void render(bool blink);
+	uint64_t due(uint64_t frame) const;
 
 	uint16_t getPalette(unsigned int n, bool force = false) const;
 	uint16_t getFontCell(unsigned int n, bool force = false) const;
 
 public:
+	// `delay`: milliseconds each frame lasts at least (0: as fast as the CPU goes)
 	LEM1802(DCPU16* c, uint16_t delay);
-	~LEM1802();
+
+	// Not owned; attach before the CPU starts
+	void attach(FrameSink* sink);
+
+	// Draws a frame into SCREEN_WIDTH x SCREEN_HEIGHT pixels of 4 bytes, as the LEM1802 does; any process can
+	static void rasterize(const ScreenState& state, uint8_t* pixels);
 
 	void interrupt() override;
-	void tick() override;
+	void wake() override;
 };
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+#include "dcpu16.h"
+
+// Runs many copies of one program side by side, for fuzzing and parameter sweeps. Registers are kept
+// in structure-of-arrays form (one array per register, one element per VM), so VMs at the same PC
+// execute each instruction together, 16 lanes to an AVX2 vector when the host has it.
+//
+// VMs whose PC drifts away from the rest wait for the others to catch up (an IF that skipped one
+// instruction, a loop that ran once more); those left waiting too long, or that reach an instruction
+// with side effects outside the VM (INT, IAS, HWI...), are peeled off and finish on the scalar DCPU16.
+// Either way each VM ends in exactly the state a DCPU16 of its own would have reached.
+class Lockstep
+{
+public:
+	struct Stats
+	{
+		uint64_t steps = 0;  // instructions issued for a group of lanes at once
+		uint64_t lanes = 0;  // instructions those steps executed, summed over the lanes
+		uint64_t scalar = 0; // instructions executed by peeled VMs on DCPU16
+		uint64_t peeled = 0; // VMs handed over to DCPU16
+	};
+
+private:
+	enum : uint8_t { ACTIVE, PARKED, DONE };
+
+	struct Location
+	{
+		enum { REGISTER, LITERAL, MEMORY } kind;
+		unsigned index;      // REGISTER
+		uint16_t literal;    // LITERAL
+		// MEMORY: per-lane addresses in addrA/addrB
+	};
+
+	struct Waiting
+	{
+		uint64_t since;              // step the oldest of them was parked at
+		std::vector<uint32_t> lanes;
+	};
+
+	size_t count, width; // VMs, and VMs rounded up to whole vectors
+	std::vector<uint16_t> reg[12];
+	std::vector<uint16_t> mem; // 64K words per VM, back to back
+	std::vector<uint64_t> cycle, executed;
+	std::vector<uint8_t> status;
+	std::vector<uint16_t> mask; // 0xFFFF for the lanes in the running group
+	std::vector<uint8_t> varies; // addresses whose contents may differ between VMs
+	std::map<uint16_t, Waiting> parked; // lanes waiting, by PC
+	size_t begin = 0, end = 0;   // lane range of the running group, in whole vectors
+	size_t leader = 0;           // its first lane
+	uint16_t pc = 0;             // the running group's PC
+	uint64_t budget = 0, maxWait = 1024;
+	size_t minGroup;             // smaller groups run on the scalar core when others are waiting
+	bool avx2;
+	Stats stats;
+
+	// Scratch, one element per lane
+	std::vector<uint16_t> va, vb, out, ex, cond, addrA, addrB;
+
+	bool fetch(uint16_t address, uint16_t& word);
+	uint16_t skip(uint16_t address, unsigned& cost);
+	Location resolve(uint16_t v, bool isA, uint16_t& next, std::vector<uint16_t>& addr);
+	void load(const Location& loc, const std::vector<uint16_t>& addr, std::vector<uint16_t>& dst);
+	void store(const Location& loc, const std::vector<uint16_t>& addr, const std::vector<uint16_t>& src);
+	void blend(std::vector<uint16_t>& dst, const std::vector<uint16_t>& src);
+	bool compute(unsigned op, int shift);
+	void step();
+	void regroup();
+	void select();
+	void peel(uint32_t lane);
+	void leave(uint32_t lane, uint8_t to);
+	void span();
+
+public:
+	Lockstep(const std::vector<uint16_t>& image, size_t count);
+
+	// Per-VM inputs, set before run()
+	void poke(size_t vm, uint16_t address, uint16_t value);
+	void setRegister(size_t vm, unsigned r, uint16_t value) { reg[r][vm] = value; }
+
+	// Lanes use AVX2 when the host supports it; false forces the portable code
+	void useAvx2(bool on);
+	bool usingAvx2() const { return avx2; }
+
+	// How many steps a diverged VM may wait for the others before it is peeled off
+	void setMaxWait(uint64_t steps) { maxWait = steps; }
+
+	// Runs every VM until its cycle counter reaches `cycles` (like stepping a DCPU16 while cycles() < budget)
+	void run(uint64_t cycles);
+
+	size_t size() const { return count; }
+	uint16_t registerOf(size_t vm, unsigned r) const { return reg[r][vm]; }
+	uint16_t peek(size_t vm, uint16_t address) const { return mem[vm << 16 | address]; }
+	uint64_t cyclesOf(size_t vm) const { return cycle[vm]; }
+	uint64_t instructionsOf(size_t vm) const { return executed[vm]; }
+	const Stats& statistics() const { return stats; }
+};
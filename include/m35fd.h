@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "hardware.h"
+
+// Floppy image: 1440 sectors of 512 little-endian words, memory-mapped from a file.
+// Files shorter than a full disk read as zeros past their end; writable ones are created or extended.
+class DiskImage
+{
+	uint8_t* data = nullptr;
+	size_t size = 0;
+	bool writable;
+
+	DiskImage(bool writable) : writable(writable) {}
+
+public:
+	static const unsigned SectorWords = 512, Sectors = 1440;
+
+	~DiskImage();
+
+	// nullptr if the file cannot be opened or mapped
+	static std::shared_ptr<DiskImage> open(const std::string& path, bool writable);
+
+	// Read-only, and one mapping per path: every VM asking for the same file shares it
+	static std::shared_ptr<DiskImage> shared(const std::string& path);
+
+	bool isWritable() const { return writable; }
+
+	void read(unsigned sector, uint16_t* words) const;
+	void write(unsigned sector, const uint16_t* words);
+};
+
+// Mackapar 3.5" Floppy Drive. Transfers run on a background thread; the guest sees them finish after
+// the drive's seek and transfer time, when the CPU reaches the cycle scheduled for it.
+class M35FD : public Hardware
+{
+public:
+	enum { STATE_NO_MEDIA = 0, STATE_READY, STATE_READY_WP, STATE_BUSY };
+	enum { ERROR_NONE = 0, ERROR_BUSY, ERROR_NO_MEDIA, ERROR_PROTECTED, ERROR_EJECT, ERROR_BAD_SECTOR, ERROR_BROKEN = 0xFFFF };
+
+private:
+	std::shared_ptr<DiskImage> media;
+	uint16_t state = STATE_NO_MEDIA, error = ERROR_NONE;
+	unsigned track = 0; // where the head is
+
+	// The transfer in progress: the I/O thread owns staging from request until done
+	unsigned sector = 0;
+	uint16_t address = 0;
+	bool writing = false;
+	uint16_t staging[DiskImage::SectorWords];
+	std::shared_ptr<DiskImage> target;
+
+	std::thread worker;
+	std::mutex lock;
+	std::condition_variable wakeup;
+	bool requested = false, quitting = false;
+	std::atomic<bool> inFlight{false};
+
+	void update(uint16_t newState, uint16_t newError);
+	void start(bool write);
+	void work();
+
+public:
+	M35FD(DCPU16* c, std::shared_ptr<DiskImage> disk = nullptr);
+	~M35FD();
+
+	void insert(std::shared_ptr<DiskImage> disk);
+	void eject();
+
+	void interrupt() override;
+	void wake() override;
+};
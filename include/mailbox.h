@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "hardware.h"
+#include "ring.h"
+
+// Message-passing link between DCPU-16s running on different host threads.
+// Each port is a pair of SPSC rings to one peer mailbox; arrivals ring the receiver's doorbell,
+// which its own CPU thread turns into an interrupt.
+//
+// HWI, by A:
+//  0: send X words (1 to 8) from [C] through port B.     C = 1 if sent, 0 if the port is full or unknown
+//  1: receive into [C] from port B (0xFFFF: any port).     X = words received (0: none), B = port
+//  2: interrupt with message B when messages arrive (0: off)
+//  3: status.  B = number of ports, C = node number, X = first port with a message waiting (0xFFFF: none)
+class Mailbox : public Hardware
+{
+public:
+	static const unsigned MaxWords = 8;
+
+	struct Message
+	{
+		uint16_t length;
+		uint16_t words[MaxWords];
+	};
+
+	typedef SpscRing<Message> Ring;
+
+private:
+	struct Port
+	{
+		std::shared_ptr<Ring> out, in;
+		Mailbox* peer;
+	};
+
+	std::vector<Port> ports;
+	uint16_t node;
+	unsigned nextPort = 0; // where a receive from any port starts looking
+	uint64_t sent = 0, received = 0;
+
+	// Written by the peers' threads, so kept apart from everything else
+	struct
+	{
+		char before[64];
+		std::atomic<bool> rung{false};
+		char after[64];
+	} doorbell;
+
+	void send();
+	void receive();
+
+public:
+	Mailbox(DCPU16* c, uint16_t node) : Hardware(c, 0x4d41494c, 1, 0x44435055), node(node) {}
+
+	// Links port `pa` of `a` with port `pb` of `b` through two rings of `capacity` messages (a power of two).
+	// Wire everything up before the CPUs start.
+	static void connect(Mailbox& a, unsigned pa, Mailbox& b, unsigned pb, size_t capacity = 64);
+
+	void interrupt() override;
+	void tick(unsigned int) override;
+
+	// Read once the CPU has stopped
+	uint64_t messagesSent() const { return sent; }
+	uint64_t messagesReceived() const { return received; }
+};
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Monotonic count, updated with relaxed atomics: cheap to bump from the CPU thread, safe to read from the publisher
+class Counter
+{
+	std::atomic<uint64_t> value{0};
+
+public:
+	void add(uint64_t n = 1) { value.fetch_add(n, std::memory_order_relaxed); }
+	uint64_t get() const { return value.load(std::memory_order_relaxed); }
+};
+
+// Distribution of values in power-of-two buckets: bucket i counts values in [2^(i-1), 2^i)
+class Histogram
+{
+	std::atomic<uint64_t> buckets[65] = {};
+	std::atomic<uint64_t> count{0}, sum{0}, max{0};
+
+public:
+	void record(uint64_t v);
+
+	// Writes {"count":..,"mean":..,"p50":..,"p99":..,"max":..}; percentiles are bucket upper bounds
+	std::string json() const;
+};
+
+// Host time from construction to stop() (or destruction) recorded into a histogram, in microseconds
+class Stopwatch
+{
+	Histogram* hist;
+	std::chrono::steady_clock::time_point start;
+
+public:
+	explicit Stopwatch(Histogram* h) : hist(h) { if(hist) start = std::chrono::steady_clock::now(); }
+	~Stopwatch() { stop(); }
+
+	void stop()
+	{
+		if(hist) hist->record((uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+		hist = nullptr;
+	}
+};
+
+// Runtime telemetry of one emulator. Attach with DCPU16::attachMetrics(); devices reach it through their CPU.
+class Metrics
+{
+public:
+	Counter instructions, cycles, keyboardEvents;
+	std::atomic<uint64_t> irqQueueDepth{0};
+	Histogram irqDepth;     // queue depth seen by each queued interrupt
+	Histogram irqLatency;   // guest cycles from interrupt(..., true) to handler entry
+	Histogram lemRasterize; // microseconds spent drawing a frame
+	Histogram lemPresent;   // microseconds spent handing a frame to SDL
+
+	Metrics() = default;
+	~Metrics();
+
+	// Starts a thread writing one JSON line every `intervalMs` to `target`: a file path,
+	// or "unix:<path>" for a listening local stream socket (reconnected as needed).
+	bool publish(const std::string& target, unsigned intervalMs = 1000);
+
+	// Snapshot of everything above as one JSON line (without the newline)
+	std::string json(double elapsed, uint64_t dInstructions, uint64_t dCycles, double dt) const;
+
+private:
+	std::thread publisher;
+	std::mutex lock;
+	std::condition_variable wakeup;
+	bool stopping = false;
+
+	void loop(std::string target, unsigned intervalMs);
+};
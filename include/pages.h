@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// A program image cut into 256-word pages, read-only and shared by every CPU that loads the same words.
+// All-zero pages are not stored: they map to the one zero page.
+class PageImage
+{
+public:
+	static const unsigned PageWords = 0x100, Pages = 0x10000 / PageWords;
+
+private:
+	std::vector<uint16_t> words; // the image's non-zero pages, back to back
+	const uint16_t* pages[Pages];
+
+	PageImage() = default;
+
+public:
+	// The image holding `prog` (loaded at 0), made on first use and kept while any CPU has it.
+	// Trailing zeros make no difference: a program and its full 64K memory dump share an image.
+	static std::shared_ptr<const PageImage> intern(const std::vector<uint16_t>& prog);
+
+	static const uint16_t* zeroPage();
+
+	const uint16_t* page(unsigned p) const { return pages[p]; }
+
+	// Whether the image is `prog`, give or take trailing zeros
+	bool holds(const std::vector<uint16_t>& prog) const;
+
+	// Pages other than the zero page
+	size_t storedPages() const { return words.size() / PageWords; }
+};
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "hardware.h"
+
+// Performance counters for the guest to time its own code: 48-bit counts of cycles, instructions
+// executed and interrupts taken since the counters were last zeroed. Counts are read back as three
+// words, B (bits 0-15), C (16-31) and X (32-47), and include the HWI that reads them.
+//
+// HWI, by A:
+//  0: zero the counters
+//  1: cycles into B, C, X
+//  2: instructions into B, C, X
+//  3: interrupts into B, C, X
+//  4: interrupt with message B (0: off) whenever the low C bits of the cycle counter overflow, i.e.
+//     every 2^C cycles (C = 1 to 48; 0 means 48)
+//
+// The device does not tick: the counts are derived from the CPU's own when they are read, and only
+// the overflow interrupt has the CPU wake it up.
+class PerfCounter : public Hardware
+{
+private:
+	uint64_t cycleBase = 0, instructionBase = 0, interruptBase = 0; // the CPU's counts when zeroed
+	unsigned bits = 48;  // the overflow interrupt's period is 2^bits cycles
+	uint64_t fired = 0;  // overflows already signalled with an interrupt
+
+	uint64_t elapsed() const;
+	void put(uint64_t count); // into B, C, X
+	void reschedule();
+
+public:
+	PerfCounter(DCPU16* c) : Hardware(c, 0x50455246, 1, 0x44435055) { ticking = false; }
+
+	void interrupt() override;
+	void wake() override;
+};
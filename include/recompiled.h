@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "dcpu16.h"
+
+/* Runtime support for programs translated to C++ by dcpu-aot. The generated translation unit
+   defines the image and one function per basic block; anything else (indirect jump targets,
+   hardware instructions, interrupts) is left to the interpreter. */
+struct Recompiled
+{
+	struct Cost { unsigned cycles, instructions; };
+
+	// A block runs straight-line code against the registers and the CPU's memory (through read()
+	// and writable()), leaves PC at the next address to execute, and reports what it spent.
+	// It keeps the interpreter's timing by stopping short, before an instruction, when an interrupt
+	// is queued or when the instruction's cycles would take the block's to `room`: the cycle a
+	// device is due at. The dispatcher ticks what the block spent, and the interpreter runs the
+	// instruction that reaches the device.
+	typedef Cost (*Block)(uint16_t* R, DCPU16& M, unsigned room);
+	struct Entry { uint16_t address; Block block; };
+
+	// Provided by the generated translation unit
+	static const char source[];
+	static const uint16_t image[];
+	static const size_t imageSize;
+	static const Entry entries[];
+	static const size_t entryCount;
+
+	// For blocks: an interrupt is queued, which the CPU may have to take before the next instruction.
+	// While interrupts are queuing (IAQ, or in a handler) that leaves queued ones to the interpreter,
+	// but the check stays one load.
+	static bool waiting(const DCPU16& M) { return M.irqs.size() != 0; }
+
+	// Runs until the CPU halts or about `budget` instructions have executed; returns how many did.
+	static uint64_t run(DCPU16& cpu, uint64_t budget = UINT64_MAX);
+};
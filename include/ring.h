@@ -0,0 +1,139 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+// Bounded single-producer/single-consumer ring: exactly one thread pushes and one thread pops, without locks.
+// Each side keeps its index (and a cached copy of the other side's) on its own cache line.
+// (Padded rather than alignas(64): C++11 operator new ignores extended alignment.)
+template<typename T>
+class SpscRing
+{
+	struct Line
+	{
+		char padding[64];
+		std::atomic<size_t> index{0};
+		size_t cached = 0;
+	};
+
+	Line producer, consumer;
+	char padding[64];
+	const size_t mask;
+	std::unique_ptr<T[]> slots;
+
+public:
+	explicit SpscRing(size_t capacity) : mask(capacity - 1), slots(new T[capacity]) {} // capacity: a power of two
+
+	bool push(const T& v)
+	{
+		size_t head = producer.index.load(std::memory_order_relaxed);
+		if(head - producer.cached > mask)
+		{
+			producer.cached = consumer.index.load(std::memory_order_acquire);
+			if(head - producer.cached > mask) return false;
+		}
+
+		slots[head & mask] = v;
+		producer.index.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool pop(T& v)
+	{
+		size_t tail = consumer.index.load(std::memory_order_relaxed);
+		if(tail == consumer.cached)
+		{
+			consumer.cached = producer.index.load(std::memory_order_acquire);
+			if(tail == consumer.cached) return false;
+		}
+
+		v = slots[tail & mask];
+		consumer.index.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer side only
+	bool empty() const
+	{
+		return consumer.index.load(std::memory_order_relaxed) == producer.index.load(std::memory_order_acquire);
+	}
+};
+
+// Bounded multi-producer/single-consumer queue (Vyukov): any thread may push, one thread pops.
+// Each slot carries a sequence number telling whose turn it is, so neither side takes a lock.
+template<typename T>
+class MpscRing
+{
+	struct Slot
+	{
+		std::atomic<size_t> turn;
+		T value;
+	};
+
+	const size_t mask;
+	std::unique_ptr<Slot[]> slots;
+	char padding[64];
+	std::atomic<size_t> head{0}; // shared by the producers
+	char padding2[64];
+	std::atomic<size_t> tail{0}; // written by the consumer alone
+
+public:
+	explicit MpscRing(size_t capacity) : mask(capacity - 1), slots(new Slot[capacity]) // capacity: a power of two
+	{
+		for(size_t i = 0; i < capacity; i++)
+			slots[i].turn.store(i, std::memory_order_relaxed);
+	}
+
+	// False when the queue is full
+	bool push(const T& v)
+	{
+		size_t pos = head.load(std::memory_order_relaxed);
+		for(;;)
+		{
+			Slot& slot = slots[pos & mask];
+			size_t turn = slot.turn.load(std::memory_order_acquire);
+
+			if(turn == pos)
+			{
+				if(head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				{
+					slot.value = v;
+					slot.turn.store(pos + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if(turn < pos)
+				return false; // the slot still holds a value from the previous lap
+			else
+				pos = head.load(std::memory_order_relaxed);
+		}
+	}
+
+	// Consumer side only
+	bool pop(T& v)
+	{
+		size_t pos = tail.load(std::memory_order_relaxed);
+		Slot& slot = slots[pos & mask];
+		if(slot.turn.load(std::memory_order_acquire) != pos + 1) return false;
+
+		v = slot.value;
+		slot.turn.store(pos + mask + 1, std::memory_order_release);
+		tail.store(pos + 1, std::memory_order_relaxed);
+		return true;
+	}
+
+	// Consumer side only
+	bool empty() const
+	{
+		size_t pos = tail.load(std::memory_order_relaxed);
+		return slots[pos & mask].turn.load(std::memory_order_acquire) != pos + 1;
+	}
+
+	// Approximate, from any thread
+	size_t size() const
+	{
+		size_t t = tail.load(std::memory_order_relaxed), h = head.load(std::memory_order_relaxed);
+		return h > t ? h - t : 0;
+	}
+};
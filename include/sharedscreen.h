@@ -0,0 +1,61 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "lem1802.h"
+
+// A LEM1802's state published in a POSIX shared-memory segment, for viewers in other processes.
+// The emulator writes it once per frame under a seqlock: the generation is odd while a frame is being
+// written, so a reader copies the frame out and keeps it only if the generation was even and unchanged.
+// Readers never write to the segment, and any number of them can watch it.
+struct SharedScreenSegment
+{
+	static const uint32_t Magic = 0x4C454D31; // "LEM1"
+	static const uint32_t Version = 1;
+
+	uint32_t magic, version;
+	std::atomic<uint32_t> generation;
+	uint32_t reserved;
+	uint64_t frame, cycle;
+	ScreenState state;
+};
+
+static_assert(ATOMIC_INT_LOCK_FREE == 2, "the seqlock needs lock-free atomics to work across processes");
+
+// Writer side: a frame sink that publishes the LEM1802's state without rasterizing it
+class SharedScreen : public FrameSink
+{
+	std::string name;
+	SharedScreenSegment* segment = nullptr;
+
+	SharedScreen() = default;
+
+public:
+	~SharedScreen(); // unmaps and unlinks the segment; viewers keep what they have mapped
+
+	// Creates the segment called `name`, e.g. "/dcpu", replacing any left by an earlier run (its viewers
+	// have to open it again); nullptr on failure, with errno set
+	static SharedScreen* create(const std::string& name);
+
+	bool wantsPixels() const override { return false; }
+	void frame(const ScreenState& state, const uint8_t* pixels, uint64_t number, uint64_t cycle) override;
+};
+
+// Reader side: maps a segment read-only
+class SharedScreenView
+{
+	const SharedScreenSegment* segment = nullptr;
+
+	SharedScreenView() = default;
+
+public:
+	~SharedScreenView();
+
+	// nullptr if there is no such segment (yet), or it is not a LEM1802's
+	static SharedScreenView* open(const std::string& name);
+
+	// Copies out the latest complete frame; false if there is none yet, or the writer is in the middle of one (try again)
+	bool read(ScreenState& state, uint64_t& frame, uint64_t& cycle) const;
+};
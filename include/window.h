@@ -0,0 +1,37 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include "lem1802.h"
+
+struct SDL_Window;
+struct SDL_Renderer;
+struct SDL_Texture;
+
+class Metrics;
+
+// SDL window showing a LEM1802. Frames arrive on the CPU thread and are presented on the thread that owns the window.
+class Window : public FrameSink
+{
+private:
+	SDL_Window* window;
+	SDL_Renderer* renderer;
+	SDL_Texture* texture;
+	std::vector<uint8_t> pixels; // the latest frame, handed over from the CPU thread
+	std::mutex frameLock;
+	std::atomic<bool> framePending{false};
+	uint32_t frameEvent;
+	Metrics* metrics;
+
+public:
+	explicit Window(Metrics* metrics = nullptr);
+	~Window();
+
+	void frame(const ScreenState& state, const uint8_t* pixels, uint64_t number, uint64_t cycle) override;
+
+	// SDL event type posted when a frame is ready; present() it from the thread that owns the window
+	uint32_t frameReady() const { return frameEvent; }
+	void present();
+};
@@ -0,0 +1,273 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include "capture.h"
+
+static size_t powerOfTwo(size_t n)
+{
+	size_t p = 1;
+	while(p < n) p <<= 1;
+	return p;
+}
+
+Capture::Capture(const Options& o) : options(o), queued(powerOfTwo(o.slots)), unused(powerOfTwo(o.slots))
+{
+	slots.resize(powerOfTwo(o.slots));
+	for(uint32_t i = 0; i < slots.size(); i++)
+	{
+		slots[i].pixels.resize(SCREEN_WIDTH * SCREEN_HEIGHT * 4);
+		unused.push(i);
+	}
+
+	rgb.resize(SCREEN_WIDTH * SCREEN_HEIGHT * 3);
+
+	if(options.format == RAW || options.format == Y4M)
+	{
+		out = fopen(options.path.c_str(), "wb");
+		failed |= !out;
+		if(out && options.format == Y4M) fprintf(out, "YUV4MPEG2 W%d H%d F60:1 Ip A1:1 C444\n", SCREEN_WIDTH, SCREEN_HEIGHT);
+	}
+
+	if(!options.hashLog.empty())
+	{
+		log = fopen(options.hashLog.c_str(), "w");
+		failed |= !log;
+	}
+
+	encoder = std::thread(&Capture::encode, this);
+}
+
+void Capture::close()
+{
+	if(!encoder.joinable()) return;
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+		wakeup.notify_one();
+	}
+
+	encoder.join();
+
+	if(out) failed |= fclose(out) != 0;
+	if(log) failed |= fclose(log) != 0;
+	out = log = nullptr;
+}
+
+Capture::Format Capture::parseFormat(const std::string& name)
+{
+	if(name == "raw") return RAW;
+	if(name == "y4m") return Y4M;
+	if(name == "png") return PNG;
+	return NONE;
+}
+
+void Capture::frame(const ScreenState&, const uint8_t* pixels, uint64_t number, uint64_t cycle)
+{
+	received.fetch_add(1, std::memory_order_relaxed);
+
+	uint32_t i;
+	if(!unused.pop(i))
+	{
+		if(!options.lossless) { dropped.fetch_add(1, std::memory_order_relaxed); return; }
+
+		do std::this_thread::sleep_for(std::chrono::microseconds(100));
+		while(!unused.pop(i));
+	}
+
+	Slot& slot = slots[i];
+	slot.number = number;
+	slot.cycle = cycle;
+	memcpy(slot.pixels.data(), pixels, slot.pixels.size());
+	queued.push(i); // there is always room: only slots.size() indices exist
+
+	// Same handshake as DCPU16::rouse(): either the encoder sees the frame, or this sees it waiting
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if(waiting.load(std::memory_order_relaxed))
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		wakeup.notify_one();
+	}
+}
+
+void Capture::encode()
+{
+	for(;;)
+	{
+		uint32_t i;
+		while(queued.pop(i))
+		{
+			write(slots[i]);
+			unused.push(i);
+		}
+
+		std::unique_lock<std::mutex> guard(lock);
+		waiting.store(true, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		if(stopping && queued.empty()) return;
+		wakeup.wait(guard, [this]() { return stopping || !queued.empty(); });
+		waiting.store(false, std::memory_order_relaxed);
+	}
+}
+
+void Capture::write(const Slot& slot)
+{
+	toRgb(slot.pixels.data(), rgb);
+
+	bool same = rgb == previous;
+	if(same) repeated++;
+
+	if(log)
+		fprintf(log, "%llu %llu %016llX%s\n", (unsigned long long)slot.number, (unsigned long long)slot.cycle, (unsigned long long)frameHash(rgb), same ? " =" : "");
+
+	if(!(same && options.dedup))
+	{
+		switch(options.format)
+		{
+			case RAW: if(out) failed |= fwrite(rgb.data(), 1, rgb.size(), out) != rgb.size(); break;
+			case Y4M: writeY4m(); break;
+			case PNG:
+			{
+				char name[32];
+				snprintf(name, sizeof(name), "%06llu.png", (unsigned long long)slot.number);
+				failed |= !writePng(options.path + name, rgb);
+				break;
+			}
+			case NONE: break;
+		}
+
+		written += options.format != NONE;
+	}
+
+	rgb.swap(previous);
+	rgb.resize(previous.size());
+}
+
+void toRgb(const uint8_t* pixels, std::vector<uint8_t>& rgb)
+{
+	rgb.resize(SCREEN_WIDTH * SCREEN_HEIGHT * 3);
+	for(size_t i = 0; i < SCREEN_WIDTH * SCREEN_HEIGHT; i++)
+	{
+		rgb[3 * i + 0] = pixels[4 * i + 2];
+		rgb[3 * i + 1] = pixels[4 * i + 1];
+		rgb[3 * i + 2] = pixels[4 * i + 0];
+	}
+}
+
+uint64_t frameHash(const std::vector<uint8_t>& rgb)
+{
+	uint64_t h = 0xcbf29ce484222325ull;
+	for(uint8_t b : rgb)
+		h = (h ^ b) * 0x100000001b3ull;
+
+	return h;
+}
+
+void Capture::writeY4m()
+{
+	if(!out) return;
+
+	// BT.601, studio range
+	size_t n = rgb.size() / 3;
+	std::vector<uint8_t> planes(3 * n);
+	for(size_t i = 0; i < n; i++)
+	{
+		int r = rgb[3 * i + 0], g = rgb[3 * i + 1], b = rgb[3 * i + 2];
+		planes[i]         = (uint8_t)((( 66 * r + 129 * g +  25 * b + 128) >> 8) +  16);
+		planes[n + i]     = (uint8_t)(((-38 * r -  74 * g + 112 * b + 128) >> 8) + 128);
+		planes[2 * n + i] = (uint8_t)(((112 * r -  94 * g -  18 * b + 128) >> 8) + 128);
+	}
+
+	failed |= fputs("FRAME\n", out) < 0 || fwrite(planes.data(), 1, planes.size(), out) != planes.size();
+}
+
+static uint32_t crc32(const uint8_t* data, size_t n)
+{
+	static uint32_t table[256];
+	static bool ready = false; // only the encoder thread gets here
+	if(!ready)
+	{
+		for(uint32_t i = 0; i < 256; i++)
+		{
+			uint32_t c = i;
+			for(int k = 0; k < 8; k++)
+				c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+			table[i] = c;
+		}
+		ready = true;
+	}
+
+	uint32_t c = 0xFFFFFFFFu;
+	for(size_t i = 0; i < n; i++)
+		c = table[(c ^ data[i]) & 0xFF] ^ (c >> 8);
+
+	return c ^ 0xFFFFFFFFu;
+}
+
+static void put32(std::vector<uint8_t>& v, uint32_t x)
+{
+	uint8_t b[4] = { (uint8_t)(x >> 24), (uint8_t)(x >> 16), (uint8_t)(x >> 8), (uint8_t)x };
+	v.insert(v.end(), b, b + 4);
+}
+
+static void chunk(std::vector<uint8_t>& png, const char* type, const std::vector<uint8_t>& data)
+{
+	put32(png, (uint32_t)data.size());
+	size_t start = png.size();
+	png.insert(png.end(), type, type + 4);
+	png.insert(png.end(), data.begin(), data.end());
+	put32(png, crc32(&png[start], png.size() - start));
+}
+
+// Truecolor PNG in stored (uncompressed) deflate blocks: nothing to link against, and cheap for the encoder
+bool writePng(const std::string& path, const std::vector<uint8_t>& rgb)
+{
+	static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+
+	std::vector<uint8_t> header;
+	put32(header, SCREEN_WIDTH);
+	put32(header, SCREEN_HEIGHT);
+	const uint8_t format[5] = { 8, 2, 0, 0, 0 }; // 8 bits per channel, RGB, deflate, adaptive filters, no interlace
+	header.insert(header.end(), format, format + 5);
+
+	// Rows of RGB, each after a filter byte of 0 (none)
+	std::vector<uint8_t> raw;
+	const size_t stride = SCREEN_WIDTH * 3;
+	for(size_t y = 0; y < SCREEN_HEIGHT; y++)
+	{
+		raw.push_back(0);
+		raw.insert(raw.end(), rgb.begin() + (long)(y * stride), rgb.begin() + (long)((y + 1) * stride));
+	}
+
+	std::vector<uint8_t> zlib = { 0x78, 0x01 };
+	for(size_t at = 0; at < raw.size(); )
+	{
+		size_t n = std::min<size_t>(raw.size() - at, 0xFFFF);
+		bool last = at + n == raw.size();
+		const uint8_t block[5] = { (uint8_t)last, (uint8_t)n, (uint8_t)(n >> 8), (uint8_t)~n, (uint8_t)(~n >> 8) };
+		zlib.insert(zlib.end(), block, block + 5);
+		zlib.insert(zlib.end(), raw.begin() + (long)at, raw.begin() + (long)(at + n));
+		at += n;
+	}
+
+	uint32_t a = 1, b = 0;
+	for(uint8_t byte : raw)
+	{
+		a = (a + byte) % 65521;
+		b = (b + a) % 65521;
+	}
+	put32(zlib, b << 16 | a);
+
+	std::vector<uint8_t> png(signature, signature + 8);
+	chunk(png, "IHDR", header);
+	chunk(png, "IDAT", zlib);
+	chunk(png, "IEND", std::vector<uint8_t>());
+
+	FILE* file = fopen(path.c_str(), "wb");
+	if(!file) return false;
+
+	bool ok = fwrite(png.data(), 1, png.size(), file) == png.size();
+	return fclose(file) == 0 && ok;
+}
@@ -1,22 +1,38 @@
 #include "dcpu16.h"
 #include "clock.h"
 
+// The CPU ticks at 100 kHz; the Clock at 60 Hz. The ratio is 5000/3, so with a divider of
+// 5000 * B the clock has ticked 3 * (elapsed CPU cycles) / divider times.
+uint64_t Clock::ticks() const
+{
+    return divider ? 3 * (cpu->cycles() - start) / divider : 0;
+}
+
+void Clock::reschedule()
+{
+    // Only interrupts need the CPU to wake us up; the counter is derived on demand
+    if(irq && divider)
+        cpu->schedule(this, start + ((fired + 1) * divider + 2) / 3);
+    else
+        cpu->schedule(this, UINT64_MAX);
+}
+
 void Clock::interrupt()
 {
     switch(cpu->reg[A])
     {
-        case 0: counter = cycles = 0; divider = 5000 * cpu->reg[B]; break;
-        case 1: cpu->reg[C] = counter; break;
-        case 2: irq = cpu->reg[B]; break;
+        case 0: start = cpu->cycles(); fired = 0; divider = 5000u * cpu->reg[B]; break;
+        case 1: cpu->reg[C] = (uint16_t)ticks(); break;
+        case 2: irq = cpu->reg[B]; fired = ticks(); break;
     }
+
+    reschedule();
 }
 
-void Clock::tick()
+void Clock::wake()
 {
-    // The CPU ticks at 100 kHz; the Clock at 60 Hz. The ratio is 5000/3.
-    for(cycles += 3; divider && cycles >= divider; cycles -= divider)
-    {
-        ++counter;
-        if(irq) cpu->interrupt(irq, true);
-    }
-}
\ No newline at end of file
+    for(uint64_t n = ticks(); fired < n; fired++)
+        cpu->interrupt(irq, true);
+
+    reschedule();
+}
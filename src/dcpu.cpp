@@ -1,92 +1,445 @@
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
 #include "dcpu16.h"
 #include "hardware.h"
+#include "metrics.h"
 
 #define PUSH DCPU16::value<'b'>(0x18, false)
 #define POP  DCPU16::value<'a'>(0x18, false)
 
 DCPU16::DCPU16(std::vector<uint16_t> prog)
 {
-	mem = new uint16_t[0x10000];
-	memset(mem, 0, 0x10000);
-	memcpy(mem, prog.data(), prog.size());
+	map(prog);
 }
 
 DCPU16::~DCPU16()
 {
 	for(const auto* p : hardware)
 		delete p;
+
+	for(unsigned p = 0; p < 0x100; p++)
+		if(dirty[p]) delete[] page[p];
+
+	for(auto* p : spares)
+		delete[] p;
+}
+
+void DCPU16::map(const std::vector<uint16_t>& prog)
+{
+	image = PageImage::intern(prog);
+
+	// Shared pages are never written through the table: writable() copies them first
+	for(unsigned p = 0; p < 0x100; p++)
+		page[p] = const_cast<uint16_t*>(image->page(p));
+}
+
+void DCPU16::copyOnWrite(unsigned p)
+{
+	uint16_t* copy;
+	if(spares.empty()) copy = new uint16_t[PageWords];
+	else { copy = spares.back(); spares.pop_back(); }
+
+	memcpy(copy, page[p], PageWords * sizeof(uint16_t));
+	page[p] = copy;
+	dirty[p] = 1;
+	copies++;
+}
+
+void DCPU16::reset(const std::vector<uint16_t>& prog)
+{
+	assert(hardware.empty());
+
+	for(unsigned p = 0; p < 0x100; p++)
+		if(dirty[p])
+		{
+			spares.push_back(page[p]);
+			page[p] = const_cast<uint16_t*>(image->page(p));
+		}
+
+	memset(dirty, 0, sizeof(dirty));
+
+	// A CPU reused for the same program is done: only the pages it wrote needed mapping back
+	if(!image->holds(prog)) map(prog);
+
+	memset(reg, 0, sizeof(reg));
+	cycle.store(0, std::memory_order_relaxed);
+	fusedPairs = retired = triggered = 0;
+	irqQueuing = false;
+	running.store(true, std::memory_order_relaxed);
+	burning.store(false, std::memory_order_relaxed);
+	timers.clear();
+	nextTimer = UINT64_MAX;
+
+	Irq irq;
+	while(irqs.pop(irq)) {}
+}
+
+unsigned DCPU16::dirtyPages() const
+{
+	return (unsigned)std::count(dirty, dirty + 0x100, 1);
+}
+
+void DCPU16::installHardware(Hardware* hw)
+{
+	hardware.push_back(hw);
+	if(hw->ticking) tickers.push_back(hw);
 }
 
 void DCPU16::tick(unsigned int n)
 {
-	while(n-- > 0)
+	uint64_t now = cycle.load(std::memory_order_relaxed) + n;
+	cycle.store(now, std::memory_order_relaxed);
+
+	for(auto* p : tickers)
+		p->tick(n);
+
+	if(now >= nextTimer) wake();
+}
+
+void DCPU16::schedule(Hardware* hw, uint64_t at)
+{
+	for(size_t i = 0; i < timers.size(); i++)
+		if(timers[i].second == hw) { timers.erase(timers.begin() + (long)i); break; }
+
+	if(at != UINT64_MAX) timers.emplace_back(at, hw);
+
+	nextTimer = UINT64_MAX;
+	for(const auto& t : timers)
+		nextTimer = std::min(nextTimer, t.first);
+}
+
+void DCPU16::wake()
+{
+	// Devices usually reschedule themselves from wake(), so take each one out before calling it
+	for(;;)
 	{
-		for(auto* p : hardware)
-			p->tick();
+		auto due = std::min_element(timers.begin(), timers.end());
+		if(due == timers.end() || due->first > cycles()) break;
+
+		Hardware* hw = due->second;
+		schedule(hw, UINT64_MAX);
+		hw->wake();
 	}
 }
 
+// Forced inline: with the copy-on-write path in it, the compiler would otherwise call it out of line
 template<char tag>
-uint16_t& DCPU16::value(uint16_t v, bool skipping)
+FORCE_INLINE uint16_t& DCPU16::value(uint16_t v, bool skipping, bool writing)
 {
-	static uint16_t tmp;
+	uint16_t& tmp = lit[tag == 'a' ? 0 : 1];
 
-	if(v == 0x18 && !skipping) return mem[tag == 'a' ? reg[SP]++ : --reg[SP]];
+	// Operands about to be written get a private copy of their page (see writable()); others are read in place
+	if(v == 0x18 && !skipping)
+	{
+		if(tag == 'a') { tmp = reg[SP]++; return writing ? writable(tmp) : word(tmp); }
+		tmp = --reg[SP];
+		return writable(tmp);
+	}
 
 	if(v >= 0x20) return tmp = v-0x21;   // 20..3F, read-only immediate
 	const auto specs = reg_specs[v];
 	uint16_t* val = nullptr; tmp = 0;
 	if((specs & 0xFu) != NOREG) tmp = *(val = &reg[specs & 0xFu]);
-	if(specs & IMM) { tick(); val = &(tmp += mem[reg[PC]++]); }
-	if(specs & MEM) return mem[tmp];
+	if(specs & IMM) val = &(tmp += read(reg[PC]++));
+	if(specs & MEM) return writing ? writable(tmp) : word(tmp);
+
 	return *val;
 }
 
-void DCPU16::interrupt(uint16_t num, bool fromHardware)
+// An operand again, once pages may have been copied since value() found it: a word read in place may
+// now be stale. The addresses of memory operands, PUSH and POP included, are still in lit[].
+uint16_t* DCPU16::reread(uint16_t v, uint16_t* operand, unsigned which)
 {
-	if(!reg[IA]) return; // Interrupts disabled
+	if(v == 0x18 || (v < 0x20 && (reg_specs[v] & MEM))) return &word(lit[which]);
+	return operand;
+}
 
-	if(irqQueuing || fromHardware)
+void DCPU16::interrupt(uint16_t num, bool fromHardware)
+{
+	if(fromHardware || irqQueuing) // in this order: other threads must not read irqQueuing
 	{
-		irqQueue[irqHead++] = num;
-		if(irqHead == irqTail ) { /* Queue overflow! TODO: Execute HCF instruction */ }
+		if(!irqs.push(Irq{num, cycles()})) return catchFire("interrupt queue overflow");
+
+		if(metrics)
+		{
+			size_t depth = irqs.size();
+			metrics->irqQueueDepth.store(depth, std::memory_order_relaxed);
+			metrics->irqDepth.record(depth);
+		}
+
+		rouse();
 	}
-	else
+	else if(reg[IA]) // with IA = 0, triggered interrupts are ignored
 	{
 		PUSH = reg[PC];
 		reg[PC] = reg[IA];
 		PUSH = reg[A]; // MOVED  --  Move DOWN by 1 if issues!!!
 		reg[A] = num;
 		irqQueuing = true;
+		triggered++;
 	}
 }
 
+void DCPU16::catchFire(const char* why)
+{
+	// Whichever thread gets here first reports it; the CPU thread stops at its next instruction
+	if(!burning.exchange(true)) std::fprintf(stderr, "DCPU-16 caught fire: %s\n", why);
+	halt();
+}
+
+// Wakes the CPU thread if it is in sleepUntil(). The fence pairs with the one there: either the sleeper
+// sees what was just posted, or this sees it sleeping and takes the lock to notify it.
+void DCPU16::rouse()
+{
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if(!sleeping.load(std::memory_order_relaxed)) return;
+
+	std::lock_guard<std::mutex> guard(sleepLock);
+	sleeper.notify_all();
+}
+
+void DCPU16::sleepUntil(std::chrono::steady_clock::time_point deadline)
+{
+	std::unique_lock<std::mutex> guard(sleepLock);
+	sleeping.store(true, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+
+	// Only interrupts the CPU can take end the sleep: while they are queuing (IAQ, or in a handler),
+	// posting one must not skip the pacing. Only this thread changes irqQueuing, so it holds throughout.
+	sleeper.wait_until(guard, deadline, [this]() { return (!irqQueuing && !irqs.empty()) || !isRunning(); });
+	sleeping.store(false, std::memory_order_relaxed);
+}
+
 void DCPU16::run()
 {
-	while(this->running == true)
+	while(isRunning())
+	{
+		// Metrics are updated per batch of instructions, to stay out of the way of step()
+		uint64_t start = cycles();
+		unsigned n = 0;
+		while(n < 4096 && isRunning())
+			n += step(UINT64_MAX);
+
+		if(metrics)
+		{
+			metrics->instructions.add(n);
+			metrics->cycles.add(cycles() - start);
+		}
+	}
+}
+
+// Superinstructions. Instruction pairs that are common in real DASM code (dcpu-bench -P profiles
+// them) run in one dispatch: after the first one, the second is recognized from its word alone and
+// run by a handler for its shape, without the generic operand decoding.
+enum Shape { JUMP = 1, RETURN = 2, CALL = 4, TEST = 8, STEP = 16, COPY = 32, SAVE = 64 };
+
+// The shapes an instruction word can have, as what its opcode, b and a each allow. A word has a shape
+// when all three allow it: three lookups and no branches, as most steps end up fusing nothing.
+static const uint8_t shapeByOp[0x20] =
+{
+	CALL,                                  // NBI: JSR label
+	JUMP | RETURN | SAVE,                  // SET PC, label / SET PC, POP / SET PUSH, reg
+	STEP, STEP,                            // ADD SUB reg, n
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	TEST, TEST, TEST, TEST, TEST, TEST, TEST, TEST, // IFx reg, n
+	0, 0, 0, 0, 0, 0,
+	COPY, COPY                             // STI STD [reg], [reg]
+};
+
+static const uint8_t shapeByB[0x20] =
+{
+	TEST | STEP, TEST | STEP | CALL, TEST | STEP, TEST | STEP, TEST | STEP, TEST | STEP, TEST | STEP, TEST | STEP, // reg (b 1: JSR)
+	COPY, COPY, COPY, COPY, COPY, COPY, COPY, COPY, // [reg]
+	0, 0, 0, 0, 0, 0, 0, 0,
+	SAVE, 0, 0, 0, JUMP | RETURN, 0, 0, 0  // PUSH, PC
+};
+
+static const uint8_t shapeByA[0x40] =
+{
+	SAVE, SAVE, SAVE, SAVE, SAVE, SAVE, SAVE, SAVE, // reg
+	COPY, COPY, COPY, COPY, COPY, COPY, COPY, COPY, // [reg]
+	0, 0, 0, 0, 0, 0, 0, 0,
+	RETURN, 0, 0, 0, 0, 0, 0,                       // POP
+	JUMP | CALL | TEST | STEP,                      // next word
+	JUMP | CALL | TEST | STEP, JUMP | CALL | TEST | STEP, JUMP | CALL | TEST | STEP, JUMP | CALL | TEST | STEP, // short literals
+	JUMP | CALL | TEST | STEP, JUMP | CALL | TEST | STEP, JUMP | CALL | TEST | STEP, JUMP | CALL | TEST | STEP,
+	JUMP | CALL | TEST | STEP, JUMP | CALL | TEST | STEP, JUMP | CALL | TEST | STEP, JUMP | CALL | TEST | STEP,
+	JUMP | CALL | TEST | STEP, JUMP | CALL | TEST | STEP, JUMP | CALL | TEST | STEP, JUMP | CALL | TEST | STEP,
+	JUMP | CALL | TEST | STEP, JUMP | CALL | TEST | STEP, JUMP | CALL | TEST | STEP, JUMP | CALL | TEST | STEP,
+	JUMP | CALL | TEST | STEP, JUMP | CALL | TEST | STEP, JUMP | CALL | TEST | STEP, JUMP | CALL | TEST | STEP,
+	JUMP | CALL | TEST | STEP, JUMP | CALL | TEST | STEP, JUMP | CALL | TEST | STEP, JUMP | CALL | TEST | STEP,
+	JUMP | CALL | TEST | STEP, JUMP | CALL | TEST | STEP, JUMP | CALL | TEST | STEP, JUMP | CALL | TEST | STEP
+};
+
+static inline unsigned shapeOf(uint16_t inst)
+{
+	return shapeByOp[inst & 0x1F] & shapeByB[(inst >> 5) & 0x1F] & shapeByA[inst >> 10];
+}
+
+// The shapes each first instruction pairs with, by opcode (specials under NBI): IFs guard jumps, calls
+// and more IFs, arithmetic is followed by its test or a return, calls by saving registers, STI by STI
+static const uint8_t pairs[0x20] =
+{
+	TEST | SAVE | STEP,                    // NBI: JSR, HWN, HWI...
+	JUMP | RETURN | CALL | TEST | STEP | SAVE, // SET
+	TEST | RETURN | STEP | JUMP,           // ADD
+	TEST | RETURN | STEP | JUMP,           // SUB
+	STEP, STEP, 0, 0, 0, 0,                // MUL MLI DIV DVI MOD MDI
+	TEST, TEST, TEST, TEST, TEST, TEST,    // AND BOR XOR SHR ASR SHL
+	JUMP | RETURN | CALL | TEST, JUMP | RETURN | CALL | TEST, JUMP | RETURN | CALL | TEST, JUMP | RETURN | CALL | TEST, // IFB IFC IFE IFN
+	JUMP | RETURN | CALL | TEST, JUMP | RETURN | CALL | TEST, JUMP | RETURN | CALL | TEST, JUMP | RETURN | CALL | TEST, // IFG IFA IFL IFU
+	0, 0, 0, 0, 0, 0,
+	COPY | TEST | STEP, COPY | TEST | STEP // STI STD
+};
+
+bool DCPU16::fuses(uint16_t first, uint16_t second)
+{
+	return (pairs[first & 0x1F] & shapeOf(second)) != 0;
+}
+
+static bool test(unsigned op, uint16_t b, uint16_t a)
+{
+	switch(op)
+	{
+		case INSTR::IFB: return (b & a) != 0;
+		case INSTR::IFC: return (b & a) == 0;
+		case INSTR::IFE: return b == a;
+		case INSTR::IFN: return b != a;
+		case INSTR::IFG: return b > a;
+		case INSTR::IFA: return (sint16)b > (sint16)a;
+		case INSTR::IFL: return b < a;
+		default:         return (sint16)b < (sint16)a; // IFU
+	}
+}
+
+// Runs the instruction at PC, which has the given shape, unless something has to happen before it. Each
+// handler does what execute() does, in the same order: operands, then the cycles (devices tick there),
+// then the effect. Words are only read after the tick. The references COPY and SAVE take before it
+// are safe because writable() has already made their page private, and private pages never move.
+// A word() taken before the tick would need execute()'s reread() guard.
+bool DCPU16::fuse(unsigned shape)
+{
+	uint16_t at = reg[PC], inst = read(at);
+
+	// Nothing may happen in between that stepping twice would do: service() has no interrupt to trigger
+	if(!isRunning() || (!irqQueuing && !irqs.empty())) return false;
+
+	uint16_t op = inst & 0x1F, b = (inst >> 5) & 0x1F, aa = inst >> 10;
+	unsigned next = aa == 0x1F;
+	uint16_t a = next ? read((uint16_t)(at + 1)) : (uint16_t)(aa - 0x21); // for the shapes with a literal a
+
+	// A jump to itself is left to a step() of its own, as in step()
+	if(shape == JUMP && a == at) return false;
+	reg[PC] = (uint16_t)(at + 1 + next);
+
+	switch(shape)
 	{
-		if(!irqQueuing && irqHead != irqTail)
+		case JUMP: tick(1 + next); reg[PC] = a; break;
+		case RETURN: { uint16_t top = reg[SP]++; tick(1); reg[PC] = read(top); break; }
+		case CALL: tick(3 + next); writable(--reg[SP]) = reg[PC]; reg[PC] = a; break;
+		case TEST: tick(2 + next); if(!test(op, reg[b], a)) execute(true); break;
+
+		case STEP:
 		{
-			 uint16_t intno = irqQueue[irqTail++];
-			 this->interrupt(intno);
+			tick(2 + next);
+			uint32_t t = op == INSTR::ADD ? reg[b] + a : reg[b] - a;
+			reg[b] = (uint16_t)t;
+			reg[EX] = (uint16_t)(t >> 16);
+			break;
 		}
 
-		execute();
+		case COPY:
+		{
+			uint16_t from = reg[aa & 7];
+			uint16_t& to = writable(reg[b & 7]);
+			tick(2);
+			to = read(from);
+			uint16_t d = op == INSTR::STI ? 1 : 0xFFFF;
+			reg[I] = (uint16_t)(reg[I] + d);
+			reg[J] = (uint16_t)(reg[J] + d);
+			break;
+		}
+
+		case SAVE: { uint16_t& to = writable(--reg[SP]); tick(1); to = reg[aa]; break; }
+	}
+
+	fusedPairs++;
+	retired++;
+	return true;
+}
+
+unsigned DCPU16::step(uint64_t until)
+{
+	service();
+	uint16_t pc = reg[PC];
+	retired++; // before, so that an HWI reading it counts itself, as it does its cycles
+	uint16_t first = execute();
+
+	// Fused only where the caller would not stop here. A jump to itself, the customary way to stop,
+	// is left alone for callers to see.
+	if(cycles() >= until || reg[PC] == pc) return 1;
+
+	// The usual answer, no, is found here without a call
+	unsigned shape = pairs[first & 0x1F] & shapeOf(read(reg[PC]));
+	return shape && fuse(shape) ? 2 : 1;
+}
+
+void DCPU16::service()
+{
+	Irq irq;
+	if(!irqQueuing && irqs.pop(irq))
+	{
+		 this->interrupt(irq.message);
+
+		 if(metrics)
+		 {
+			 metrics->irqQueueDepth.store(irqs.size(), std::memory_order_relaxed);
+			 if(reg[IA]) metrics->irqLatency.record(cycles() - irq.cycle);
+		 }
 	}
 }
 
-void DCPU16::halt() { this->running = false; }
+void DCPU16::halt()
+{
+	running.store(false, std::memory_order_relaxed);
+	rouse();
+}
 
-void DCPU16::execute(bool skipping)
+uint16_t DCPU16::execute(bool skipping)
 {
-	uint16_t inst = mem[reg[PC]++]; // read instruction and point to the next one
+	uint16_t inst = read(reg[PC]++); // read instruction and point to the next one
 
 	uint16_t aa = (inst >> 10) & 0x3f;
 	uint16_t bb = (inst >>  5) & 0x1f;
 	uint16_t op = (inst >>  0) & 0x1f;
 
-	uint16_t& a = value<'a'>(aa, skipping);
-	uint16_t& b = (op == INSTR::NBI ? op : value<'b'>(bb, skipping));
+	// Only b is written, besides a for IAG and HWN; IFs only compare. JSR reads a after pushing, so a
+	// word it pushes over must be read from the same (private) copy.
+	bool special = !skipping && op == INSTR::NBI;
+	unsigned copied = copies;
+	uint16_t* pa = &value<'a'>(aa, skipping, special && (bb == NBI::JSR || bb == NBI::IAG || bb == NBI::HWN));
+	uint16_t* pb = (op == INSTR::NBI ? &op : &value<'b'>(bb, skipping, !skipping && !(op >= INSTR::IFB && op <= INSTR::IFU)));
+
+	// Charge the whole instruction at once: its operands' next words, plus the opcode itself
+	// (or, while skipping, one extra cycle per skipped IF)
+	unsigned cycles = operand_cycles(aa) + (op == INSTR::NBI ? 0 : operand_cycles(bb));
+	if(skipping) cycles += (op >= INSTR::IFB && op <= INSTR::IFU);
+	else cycles += op == INSTR::NBI ? special_cycles[bb] : basic_cycles[op];
+
+	// A page an operand is read from in place may have been copied since, by b's own write or by a
+	// device woken by the tick writing memory (M35FD's wake(), say): find the operands again in the
+	// copy, which any such write went to
+	tick(cycles);
+	if(copies != copied && !skipping)
+	{
+		pa = reread(aa, pa, 0);
+		if(op != INSTR::NBI) pb = reread(bb, pb, 1);
+	}
+
+	uint16_t& a = *pa;
+	uint16_t& b = *pb;
 
 	sint32 sa = (sint16)a;
 	sint32 sb = (sint16)b;
@@ -99,10 +452,7 @@ void DCPU16::execute(bool skipping)
 	if(skipping)
 	{
 		if(op >= INSTR::IFB && op <= INSTR::IFU)
-		{
-			tick(1);
 			execute(true);
-		}
 	}
 	else
 	{
@@ -111,47 +461,46 @@ void DCPU16::execute(bool skipping)
 			case INSTR::NBI:
 				switch(bb)
 				{
-					case NBI::JSR: tick(3); PUSH = reg[PC]; reg[PC] = a; break;
-					case NBI::INT: tick(4); interrupt(a); break;
-					case NBI::IAG: tick(1); a = reg[IA]; break;
-					case NBI::IAS: tick(1); reg[IA] = a; break;
-					case NBI::RFI: tick(3); irqQueuing = false; reg[A] = POP; reg[PC] = POP; break;
-					case NBI::IAQ: tick(2); irqQueuing = (a == 0 ? false : true); break;
-					case NBI::HWN: tick(2); a = (uint16_t)hardware.size(); break;
-					case NBI::HWQ: tick(4); if(a < hardware.size()) hardware[a]->query(); break;
-					case NBI::HWI: tick(4); if(a < hardware.size()) hardware[a]->interrupt(); break;
+					case NBI::JSR: PUSH = reg[PC]; reg[PC] = a; break;
+					case NBI::HCF: catchFire("HCF"); break;
+					case NBI::INT: interrupt(a); break;
+					case NBI::IAG: a = reg[IA]; break;
+					case NBI::IAS: reg[IA] = a; break;
+					case NBI::RFI: irqQueuing = false; reg[A] = POP; reg[PC] = POP; break;
+					case NBI::IAQ: irqQueuing = (a == 0 ? false : true); break;
+					case NBI::HWN: a = (uint16_t)hardware.size(); break;
+					case NBI::HWQ: if(a < hardware.size()) hardware[a]->query(); break;
+					case NBI::HWI: if(a < hardware.size()) hardware[a]->interrupt(); break;
 					default: std::fprintf(stderr, "Invalid opcode %04X at PC=%04X\n", op, reg[PC]); break;
 				}
 				break;
 
-			case INSTR::SET: tick(1); b = a; break;
-			case INSTR::ADD: tick(2); t =  b +  a; b = (uint16_t)t; reg[EX] = (uint16_t)(t >> 16); break;
-			case INSTR::SUB: tick(2); t =  b -  a; b = (uint16_t)t; reg[EX] = (uint16_t)(t >> 16); break;
-			case INSTR::MUL: tick(2); t =  b *  a; b = (uint16_t)t; reg[EX] = (uint16_t)(t >> 16); break;
-			case INSTR::MLI: tick(2); s = sb * sa; b = (uint16_t)s; reg[EX] = (uint16_t)(s >> 16); break;
-			case INSTR::DIV: tick(3); t =  a ? (wb << 16) /  a : 0; b = (uint16_t)(t >> 16); reg[EX] = (uint16_t)t; break;
-			case INSTR::DVI: tick(3); s = sa ? (sb << 16) / sa : 0; b = (uint16_t)(s >> 16); reg[EX] = (uint16_t)s; break;
-			case INSTR::MOD: tick(3); b = (uint16_t)( a ?  b %  a : 0); break;
-			case INSTR::MDI: tick(3); b = (uint16_t)(sa ? sb % sa : 0); break;
-			case INSTR::AND: tick(1); b &= a; break;
-			case INSTR::BOR: tick(1); b |= a; break;
-			case INSTR::XOR: tick(1); b ^= a; break;
-			case INSTR::SHR: tick(1); t = (wb << 16) >> a; b = (uint16_t)(t >> 16); reg[EX] = (uint16_t)t; break;
-			case INSTR::ASR: tick(1); s = (sb << 16) >> a; b = (uint16_t)(s >> 16); reg[EX] = (uint16_t)s; break;
-			case INSTR::SHL: tick(1); t = wb << a; b = (uint16_t)t; reg[EX] = (uint16_t)(t >> 16); break;
-			case INSTR::IFB: tick(2); if(!( b &  a)) execute(true); break;
-			case INSTR::IFC: tick(2); if(   b &  a ) execute(true); break;
-			case INSTR::IFE: tick(2); if(!( b == a)) execute(true); break;
-			case INSTR::IFN: tick(2); if(!( b != a)) execute(true); break;
-			case INSTR::IFG: tick(2); if(!( b >  a)) execute(true); break;
-			case INSTR::IFA: tick(2); if(!(sb > sa)) execute(true); break;
-			case INSTR::IFL: tick(2); if(!( b <  a)) execute(true); break;
-			case INSTR::IFU: tick(2); if(!(sb < sa)) execute(true); break;
-			case INSTR::ADX: tick(3); t = b + a + reg[EX]; b = (uint16_t)t; reg[EX] = (t >> 16) != 0 ? 0x0001 : 0x0000; break;
-			case INSTR::SBX: tick(3); t = b - a + reg[EX]; b = (uint16_t)t; reg[EX] = (t >> 16); break; // EX should be 0xFFFF only if underflow!
-			case INSTR::STI: tick(2); b = a; reg[I]++; reg[J]++; break;
-			case INSTR::STD: tick(2); b = a; reg[I]--; reg[J]--; break;
+			case INSTR::SET: b = a; break;
+			case INSTR::ADD: t =  b +  a; b = (uint16_t)t; reg[EX] = (uint16_t)(t >> 16); break;
+			case INSTR::SUB: t =  b -  a; b = (uint16_t)t; reg[EX] = (uint16_t)(t >> 16); break;
+			case INSTR::MUL: t =  b *  a; b = (uint16_t)t; reg[EX] = (uint16_t)(t >> 16); break;
+			case INSTR::MLI: s = sb * sa; b = (uint16_t)s; reg[EX] = (uint16_t)(s >> 16); break;
+			case INSTR::DIV: t =  a ? (wb << 16) /  a : 0; b = (uint16_t)(t >> 16); reg[EX] = (uint16_t)t; break;
+			case INSTR::DVI: s = sa ? (sb << 16) / sa : 0; b = (uint16_t)(s >> 16); reg[EX] = (uint16_t)s; break;
+			case INSTR::MOD: b = (uint16_t)( a ?  b %  a : 0); break;
+			case INSTR::MDI: b = (uint16_t)(sa ? sb % sa : 0); break;
+			case INSTR::AND: b &= a; break;
+			case INSTR::BOR: b |= a; break;
+			case INSTR::XOR: b ^= a; break;
+			case INSTR::SHR: t = (wb << 16) >> a; b = (uint16_t)(t >> 16); reg[EX] = (uint16_t)t; break;
+			case INSTR::ASR: s = (sb << 16) >> a; b = (uint16_t)(s >> 16); reg[EX] = (uint16_t)s; break;
+			case INSTR::SHL: t = wb << a; b = (uint16_t)t; reg[EX] = (uint16_t)(t >> 16); break;
+			case INSTR::IFB: case INSTR::IFC: case INSTR::IFE: case INSTR::IFN:
+			case INSTR::IFG: case INSTR::IFA: case INSTR::IFL: case INSTR::IFU:
+				if(!test(op, b, a)) execute(true);
+				break;
+			case INSTR::ADX: t = b + a + reg[EX]; b = (uint16_t)t; reg[EX] = (t >> 16) != 0 ? 0x0001 : 0x0000; break;
+			case INSTR::SBX: t = b - a + reg[EX]; b = (uint16_t)t; reg[EX] = (t >> 16); break; // EX should be 0xFFFF only if underflow!
+			case INSTR::STI: b = a; reg[I]++; reg[J]++; break;
+			case INSTR::STD: b = a; reg[I]--; reg[J]--; break;
 			default: std::fprintf(stderr, "Invalid opcode %04X at PC=%04X\n", op, reg[PC]); break;
 		}
 	}
+
+	return inst;
 }
\ No newline at end of file
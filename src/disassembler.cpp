@@ -0,0 +1,148 @@
+#include <algorithm>
+#include <cstring>
+
+#include "disassembler.h"
+
+static const char hexdigits[] = "0123456789ABCDEF";
+
+static char* hex4(char* p, uint16_t v)
+{
+	for(int shift = 12; shift >= 0; shift -= 4)
+		*p++ = hexdigits[(v >> shift) & 0xF];
+
+	return p;
+}
+
+static char* hex(char* p, uint16_t v)
+{
+	*p++ = '0'; *p++ = 'x';
+
+	int shift = 12;
+	while(shift > 0 && !((v >> shift) & 0xF)) shift -= 4;
+	for(; shift >= 0; shift -= 4)
+		*p++ = hexdigits[(v >> shift) & 0xF];
+
+	return p;
+}
+
+static char* copy(char* p, const char* s, size_t n)
+{
+	memcpy(p, s, n);
+	return p + n;
+}
+
+Disassembler::Disassembler(const uint16_t* memory, const std::unordered_map<std::string, sint32>& symbols) : mem(memory)
+{
+	for(const auto& s : symbols)
+		labels.emplace_back((uint16_t)s.second, s.first);
+
+	std::sort(labels.begin(), labels.end());
+
+	// Join aliases of the same address, so each address has a single entry
+	size_t out = 0;
+	for(size_t i = 0; i < labels.size(); i++)
+	{
+		if(out && labels[out - 1].first == labels[i].first)
+			labels[out - 1].second += "=" + labels[i].second;
+		else if(out++ != i)
+			labels[out - 1] = std::move(labels[i]);
+	}
+	labels.resize(out);
+
+	for(const auto& l : labels)
+	{
+		labelled[l.first / 64] |= 1ull << (l.first % 64);
+		longest = std::max(longest, l.second.size());
+	}
+}
+
+const std::string* Disassembler::label(uint16_t addr) const
+{
+	if(!(labelled[addr / 64] & (1ull << (addr % 64)))) return nullptr;
+
+	auto it = std::lower_bound(labels.begin(), labels.end(), addr,
+		[](const std::pair<uint16_t, std::string>& l, uint16_t a) { return l.first < a; });
+
+	return &it->second;
+}
+
+unsigned Disassembler::length(uint16_t inst)
+{
+	unsigned aa = (inst >> 10) & 0x3F, bb = (inst >> 5) & 0x1F, op = inst & 0x1F;
+
+	unsigned n = 1;
+	if(aa < 0x20 && (reg_specs[aa] & IMM)) n++;
+	if(op && (reg_specs[bb] & IMM)) n++;
+
+	return n;
+}
+
+char* Disassembler::operand(char* p, char which, unsigned v, uint16_t& pc) const
+{
+	*p++ = ' ';
+	if(v == 0x18) return which == 'b' ? copy(p, "PUSH", 4) : copy(p, "POP", 3);
+	if(v >= 0x20) return hex(p, uint16_t(int(v) - 0x21));
+
+	const auto specs = reg_specs[v];
+	if(specs & MEM) *p++ = '[';
+	if((specs & 0xFu) != NOREG)
+	{
+		const char* name = regnames[specs & 0xFu];
+		p = copy(p, name, strlen(name));
+		if(specs & IMM) p = copy(p, " + ", 3);
+	}
+	if(specs & IMM)
+	{
+		uint16_t w = mem[pc++];
+		p = hex(p, w);
+
+		if(const std::string* l = label(w)) { *p++ = '='; p = copy(p, l->data(), l->size()); }
+	}
+	if(specs & MEM) *p++ = ']';
+
+	return p;
+}
+
+size_t Disassembler::instruction(uint16_t pc, char* out) const
+{
+	char* p = out;
+
+	if(const std::string* l = label(pc)) { p = copy(p, l->data(), l->size()); p = copy(p, ": ", 2); }
+
+	unsigned v = mem[pc++], o = (v & 0x1F), bb = (v >> 5) & 0x1F, aa = (v >> 10) & 0x3F;
+	p = copy(p, &ins_set[3 * (o ? 32 + o : bb)], 3);
+
+	// The next word of 'a' comes first in memory, but 'a' is printed last
+	uint16_t apc = pc, bpc = (uint16_t)(pc + (aa < 0x20 && (reg_specs[aa] & IMM) ? 1 : 0));
+	if(o) { p = operand(p, 'b', bb, bpc); *p++ = ','; }
+
+	return (size_t)(operand(p, 'a', aa, apc) - out);
+}
+
+size_t Disassembler::list(uint32_t& pc, uint32_t end, char* out, size_t capacity) const
+{
+	char* p = out;
+	const size_t line = maxLine();
+
+	while(pc < end && (size_t)(p - out) + line <= capacity)
+	{
+		uint16_t addr = (uint16_t)pc;
+		unsigned n = length(mem[addr]);
+
+		p = hex4(p, addr); *p++ = ':';
+		for(unsigned i = 0; i < 3; i++)
+		{
+			*p++ = ' ';
+			if(i < n) p = hex4(p, mem[(uint16_t)(addr + i)]);
+			else p = copy(p, "    ", 4);
+		}
+		*p++ = ' ';
+
+		p += instruction(addr, p);
+		*p++ = '\n';
+
+		pc += n;
+	}
+
+	return (size_t)(p - out);
+}
@@ -0,0 +1,36 @@
+#include <thread>
+
+#include <SDL2/SDL.h>
+
+#include "events.h"
+#include "dcpu16.h"
+#include "keyboard.h"
+#include "window.h"
+
+void runInteractive(DCPU16& cpu, Window* screen, Keyboard* keyboard, const std::function<void()>& emulate)
+{
+	std::thread emulator([&]()
+	{
+		emulate();
+		cpu.halt();
+
+		// Wake the event loop up in case the program stopped by itself
+		SDL_Event event = {};
+		event.type = SDL_QUIT;
+		SDL_PushEvent(&event);
+	});
+
+	SDL_Event event;
+	while(cpu.isRunning() && SDL_WaitEvent(&event))
+	{
+		if(event.type == SDL_QUIT)
+			cpu.halt();
+		else if((event.type == SDL_KEYDOWN || event.type == SDL_KEYUP) && keyboard)
+			keyboard->post(event.key.keysym, event.type == SDL_KEYDOWN);
+		else if(screen && event.type == screen->frameReady())
+			screen->present();
+	}
+
+	cpu.halt();
+	emulator.join();
+}
@@ -1,5 +1,6 @@
 #include <SDL2/SDL.h>
 #include "keyboard.h"
+#include "metrics.h"
 
 uint8_t Keyboard::translate(const SDL_Keysym& key)
 {
@@ -24,37 +25,33 @@ uint8_t Keyboard::translate(const SDL_Keysym& key)
 	return 0;
 }
 
-void Keyboard::interrupt()
+Keyboard::Keyboard(DCPU16* c) : Hardware(c, 0x30cf7406, 1, 0)
 {
-	switch(cpu->reg[A])
-	{
-		case 0: bufhead = buftail; break;
-		case 1: cpu->reg[C] = (bufhead == buftail ? 0 : buffer[buftail++]); break;
-		case 2: cpu->reg[C] = (cpu->reg[B] < 0x100 && state[cpu->reg[B]]); break;
-		case 3: irq = cpu->reg[B]; break;
-	}
+	ticking = false;
+	for(auto& key : state) key.store(false, std::memory_order_relaxed);
 }
 
-void Keyboard::tick()
+void Keyboard::post(const SDL_Keysym& key, bool down)
 {
-	for(counter += 3; counter >= 10000; counter -= 10000) // Check keyboard events 50 times in a second
+	uint8_t code = translate(key);
+	if(cpu->metrics) cpu->metrics->keyboardEvents.add();
+
+	state[code].store(down, std::memory_order_relaxed);
+	if(code && down) buffer.push(code); // dropped if the guest has let 256 keys pile up
+
+	// Stamped with the guest cycle it arrived at; wakes the CPU if a device has it sleeping
+	if(uint16_t m = message.load(std::memory_order_relaxed)) cpu->interrupt(m, true);
+}
+
+void Keyboard::interrupt()
+{
+	uint8_t code = 0;
+
+	switch(cpu->reg[A])
 	{
-		SDL_Event event;
-		while(SDL_PollEvent(&event))
-		{
-			if(event.type == SDL_QUIT)
-			{
-				cpu->halt();
-				break;
-			}
-			else if(event.type == SDL_KEYDOWN || event.type == SDL_KEYUP)
-			{
-				uint8_t code = translate(event.key.keysym);
-
-				state[code] = (event.type == SDL_KEYDOWN);
-				if(code && event.type == SDL_KEYDOWN) buffer[bufhead++] = code;
-				if(irq) cpu->interrupt(irq, true);
-			}
-		}
+		case 0: while(buffer.pop(code)) {} break;
+		case 1: buffer.pop(code); cpu->reg[C] = code; break;
+		case 2: cpu->reg[C] = (cpu->reg[B] < 0x100 && state[cpu->reg[B]].load(std::memory_order_relaxed)); break;
+		case 3: message.store(cpu->reg[B], std::memory_order_relaxed); break;
 	}
-}
\ No newline at end of file
+}
@@ -1,27 +1,30 @@
-#include <SDL2/SDL.h>
-#include <SDL2/SDL_render.h>
+#include <algorithm>
+#include <cstring>
 
 #include "lem1802.h"
 #include "dcpu16.h"
+#include "metrics.h"
 
 LEM1802::LEM1802(DCPU16* c, uint16_t delay) : Hardware(c, 0x7349f615, 0x1802, 0x1c6c8b36), delay(delay)
 {
-	pixels.resize(SCREEN_WIDTH * SCREEN_HEIGHT * 4, 0);
-	this->counter = 0;
+	// Frames come on time without ticking: the CPU wakes the screen when one is due
+	ticking = false;
+	start = cpu->cycles();
+	cpu->schedule(this, due(1));
 
-	SDL_Init(SDL_INIT_EVERYTHING);
-	atexit(SDL_Quit);
-
-	window = SDL_CreateWindow("LEM1802", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, SCREEN_WIDTH * SCALE, SCREEN_HEIGHT * SCALE, SDL_WINDOW_SHOWN);
-	renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
-	texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, SCREEN_WIDTH, SCREEN_HEIGHT);
+	deadline = std::chrono::steady_clock::now();
 }
 
-LEM1802::~LEM1802()
+void LEM1802::attach(FrameSink* sink)
 {
-	SDL_DestroyRenderer(renderer);
-	SDL_DestroyWindow(window);
-	SDL_Quit();
+	sinks.push_back(sink);
+
+	// The frame buffer is only there for sinks that want pixels: a headless screen does without
+	if(sink->wantsPixels())
+	{
+		rasterizing = true;
+		pixels.resize(SCREEN_WIDTH * SCREEN_HEIGHT * 4, 0);
+	}
 }
 
 void LEM1802::interrupt()
@@ -32,71 +35,98 @@ void LEM1802::interrupt()
 		case 1: fontBase    = cpu->reg[B]; break;
 		case 2: paletteBase = cpu->reg[B]; break;
 		case 3: borderColor = cpu->reg[B] & 0xF; break;
-		case 4: for(uint16_t n = 0; n < 256; ++n) { cpu->mem[uint16_t(cpu->reg[B] + n)] = getFontCell(n, true); cpu->tick(1); } break;
-		case 5: for(uint16_t n = 0; n <  16; ++n) { cpu->mem[uint16_t(cpu->reg[B] + n)] = getPalette(n,  true); cpu->tick(1); } break;
+		case 4: for(uint16_t n = 0; n < 256; ++n) cpu->store(uint16_t(cpu->reg[B] + n), getFontCell(n, true)); cpu->tick(256); break;
+		case 5: for(uint16_t n = 0; n <  16; ++n) cpu->store(uint16_t(cpu->reg[B] + n), getPalette(n,  true)); cpu->tick(16); break;
 	}
 }
 
-void LEM1802::tick()
+// The screen refreshes at 60 Hz. The CPU ticks at 100 kHz. The ratio is 5000/3, so frame n (from 1) is
+// due once 3 * (elapsed CPU cycles) reaches 5000 * n.
+uint64_t LEM1802::due(uint64_t frame) const
+{
+	return start + (5000 * frame + 2) / 3;
+}
+
+void LEM1802::wake()
 {
-	// The screen refreshes at 60 Hz. The CPU ticks at 100 kHz. The ratio is 5000/3.
-	for(this->counter += 3; this->counter >= 5000; this->counter -= 5000)
+	while(cpu->cycles() >= due(frames + 1))
 		render(++blink & 32);
+
+	cpu->schedule(this, due(frames + 1));
 }
 
 void LEM1802::render(bool blink)
 {
-	uint16_t backColor = getPalette(borderColor);
+	for(unsigned i = 0; i < 32 * 12; i++)
+		state.vram[i] = cpu->read((uint16_t)(ramBase + i));
+	for(unsigned i = 0; i < 256; i++)
+		state.font[i] = getFontCell(i);
+	for(unsigned i = 0; i < 16; i++)
+		state.palette[i] = getPalette(i);
+	state.border = borderColor;
+	state.blink = blink;
+
+	if(rasterizing)
+	{
+		Metrics* metrics = cpu->metrics;
+		Stopwatch stopwatch(metrics ? &metrics->lemRasterize : nullptr);
+		rasterize(state, pixels.data());
+	}
 
-	Uint8 r = ((backColor >> 8) & 0x0F) * 17; // adjustment
-	Uint8 g = ((backColor >> 4) & 0x0F) * 17; // adjustment
-	Uint8 b = ((backColor >> 0) & 0x0F) * 17; // adjustment
+	for(auto* sink : sinks)
+		sink->frame(state, rasterizing ? pixels.data() : nullptr, frames, cpu->cycles());
+	frames++;
 
-	SDL_SetRenderDrawColor(renderer, r, g, b, SDL_ALPHA_OPAQUE);
-	SDL_RenderClear(renderer);
+	// Pace by absolute deadlines, so waking early for an interrupt is made up on the next frame
+	if(!delay) return;
+
+	auto now = std::chrono::steady_clock::now();
+	deadline = std::max(deadline + std::chrono::milliseconds(delay), now);
+	if(deadline > now) cpu->sleepUntil(deadline);
+}
+
+void LEM1802::rasterize(const ScreenState& state, uint8_t* pixels)
+{
+	uint8_t colors[16][4];
+	for(unsigned int n = 0; n < 16; n++)
+	{
+		const uint16_t col = state.palette[n];
+		colors[n][0] = uint8_t(((col >> 0) & 0x0F) * 17); // Blue
+		colors[n][1] = uint8_t(((col >> 4) & 0x0F) * 17); // Green
+		colors[n][2] = uint8_t(((col >> 8) & 0x0F) * 17); // Red
+		colors[n][3] = 0xFF;
+	}
 
 	for(unsigned int y = 0; y < 12; y++)
 	{
 		for(unsigned int x = 0; x < 32; x++)
 		{
-			uint16_t v = cpu->mem[(uint16_t)(ramBase + x + y * 32)];
+			uint16_t v = state.vram[x + y * 32];
 
-			uint8_t fg = (v >> 12) & 0x0F;
-			uint8_t bg = (v >>  8) & 0x0F;
-			uint8_t ch = (v >>  0) & 0x7F;
-			uint8_t bl = (v >>  0) & 0x80;
+			unsigned fg = (v >> 12) & 0x0F;
+			unsigned bg = (v >>  8) & 0x0F;
+			unsigned ch = (v >>  0) & 0x7F;
+			unsigned bl = (v >>  0) & 0x80;
 
-			uint16_t font[2] = { getFontCell(ch * 2 + 0), getFontCell(ch * 2 + 1) };
+			uint16_t font[2] = { state.font[ch * 2 + 0], state.font[ch * 2 + 1] };
 
-			if(bl && blink) fg = bg;
+			if(bl && state.blink) fg = bg;
 
 			for(unsigned int yp = 0; yp < 8; yp++)
 			{
 				for(unsigned int xp = 0; xp < 4; ++xp)
 				{
-					const uint8_t color = ((font[xp / 2] & (1 << (yp + 8 * ((xp & 1) ^ 1)))) ? fg : bg);
+					const unsigned color = ((font[xp / 2] & (1 << (yp + 8 * ((xp & 1) ^ 1)))) ? fg : bg);
 
 					const unsigned int _x = x * 4 + xp;
 					const unsigned int _y = y * 8 + yp;
 					const unsigned int offset = (SCREEN_WIDTH * 4 * _y) + _x * 4;
 
-					const uint16_t col = getPalette(color);
-
-					pixels[offset + 0] = Uint8(((col >> 0) & 0x0F) * 17); // Blue
-					pixels[offset + 1] = Uint8(((col >> 4) & 0x0F) * 17); // Green
-					pixels[offset + 2] = Uint8(((col >> 8) & 0x0F) * 17); // Red
-					pixels[offset + 3] = SDL_ALPHA_OPAQUE;
+					memcpy(&pixels[offset], colors[color], 4);
 				}
 			}
 		}
 	}
-
-	SDL_Delay(delay);
-
-	SDL_UpdateTexture(texture, NULL, &pixels[0], SCREEN_WIDTH * 4);
-
-	SDL_RenderCopy(renderer, texture, NULL, NULL);
-	SDL_RenderPresent(renderer);
 }
 
 uint16_t LEM1802::getPalette(unsigned int n, bool force) const
@@ -104,7 +134,7 @@ uint16_t LEM1802::getPalette(unsigned int n, bool force) const
 	static const uint16_t palette[16] =
 		{ 0x000, 0x00A, 0x0A0, 0x0AA, 0xA00, 0xA0A, 0xAA5, 0xAAA, 0x555, 0x55F, 0x5F5, 0x5FF, 0xF55, 0xF5F, 0xFF5, 0xFFF };
 
-	return (force || !paletteBase) ? palette[n] : cpu->mem[(uint16_t)(paletteBase + n)];
+	return (force || !paletteBase) ? palette[n] : cpu->read((uint16_t)(paletteBase + n));
 }
 
 uint16_t LEM1802::getFontCell(unsigned int n, bool force) const
@@ -129,5 +159,5 @@ uint16_t LEM1802::getFontCell(unsigned int n, bool force) const
 			0x6C10, 0x6C00, 0x9CA0, 0x7C00, 0x6454, 0x4C00, 0x0836, 0x4100, 0x0077, 0x0000, 0x4136, 0x0800, 0x0201, 0x0201, 0x704C, 0x7000
 		};
 
-	return (force || !fontBase) ? font4x8[n] : cpu->mem[(uint16_t)(fontBase + n)];
+	return (force || !fontBase) ? font4x8[n] : cpu->read((uint16_t)(fontBase + n));
 }
\ No newline at end of file
@@ -0,0 +1,561 @@
+#include <algorithm>
+
+#include "lockstep.h"
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define DCPU_LOCKSTEP_AVX2 1
+#include <immintrin.h>
+#endif
+
+static const size_t Lanes = 16; // 16-bit lanes in a 256-bit vector
+
+static bool hostHasAvx2()
+{
+#ifdef DCPU_LOCKSTEP_AVX2
+	return __builtin_cpu_supports("avx2");
+#else
+	return false;
+#endif
+}
+
+// One lane of DCPU16::execute(): the same expressions, so results match bit for bit
+static void lane(unsigned op, uint16_t a, uint16_t b, uint16_t exIn, uint16_t& out, uint16_t& ex, uint16_t& cond)
+{
+	sint32 sa = (sint16)a;
+	sint32 sb = (sint16)b;
+
+	uint32_t t;
+	sint32 s;
+
+	uint32_t wb = b;
+
+	switch(op)
+	{
+		case INSTR::SET: out = a; break;
+		case INSTR::ADD: t =  b +  a; out = (uint16_t)t; ex = (uint16_t)(t >> 16); break;
+		case INSTR::SUB: t =  b -  a; out = (uint16_t)t; ex = (uint16_t)(t >> 16); break;
+		case INSTR::MUL: t =  b *  a; out = (uint16_t)t; ex = (uint16_t)(t >> 16); break;
+		case INSTR::MLI: s = sb * sa; out = (uint16_t)s; ex = (uint16_t)(s >> 16); break;
+		case INSTR::DIV: t =  a ? (wb << 16) /  a : 0; out = (uint16_t)(t >> 16); ex = (uint16_t)t; break;
+		case INSTR::DVI: s = sa ? (sb << 16) / sa : 0; out = (uint16_t)(s >> 16); ex = (uint16_t)s; break;
+		case INSTR::MOD: out = (uint16_t)( a ?  b %  a : 0); break;
+		case INSTR::MDI: out = (uint16_t)(sa ? sb % sa : 0); break;
+		case INSTR::AND: out = b & a; break;
+		case INSTR::BOR: out = b | a; break;
+		case INSTR::XOR: out = b ^ a; break;
+		case INSTR::SHR: t = (wb << 16) >> a; out = (uint16_t)(t >> 16); ex = (uint16_t)t; break;
+		case INSTR::ASR: s = (sb << 16) >> a; out = (uint16_t)(s >> 16); ex = (uint16_t)s; break;
+		case INSTR::SHL: t = wb << a; out = (uint16_t)t; ex = (uint16_t)(t >> 16); break;
+		case INSTR::IFB: cond = ( b &  a) ? 0xFFFF : 0; break;
+		case INSTR::IFC: cond = ( b &  a) ? 0 : 0xFFFF; break;
+		case INSTR::IFE: cond = ( b == a) ? 0xFFFF : 0; break;
+		case INSTR::IFN: cond = ( b != a) ? 0xFFFF : 0; break;
+		case INSTR::IFG: cond = ( b >  a) ? 0xFFFF : 0; break;
+		case INSTR::IFA: cond = (sb > sa) ? 0xFFFF : 0; break;
+		case INSTR::IFL: cond = ( b <  a) ? 0xFFFF : 0; break;
+		case INSTR::IFU: cond = (sb < sa) ? 0xFFFF : 0; break;
+		case INSTR::ADX: t = b + a + exIn; out = (uint16_t)t; ex = (t >> 16) != 0 ? 0x0001 : 0x0000; break;
+		case INSTR::SBX: t = b - a + exIn; out = (uint16_t)t; ex = (uint16_t)(t >> 16); break;
+		case INSTR::STI: out = a; break;
+		case INSTR::STD: out = a; break;
+	}
+}
+
+#ifdef DCPU_LOCKSTEP_AVX2
+// The opcodes with a direct 16-bit vector form; shifts only by a literal below 32, the range where the
+// scalar shifts are well defined. Returns false for anything else, which then goes lane by lane.
+__attribute__((target("avx2")))
+static bool computeAvx2(unsigned op, int shift, const uint16_t* a, const uint16_t* b, uint16_t* out, uint16_t* ex, uint16_t* cond, size_t from, size_t to)
+{
+	switch(op)
+	{
+		case INSTR::SET: case INSTR::ADD: case INSTR::SUB: case INSTR::MUL: case INSTR::MLI: case INSTR::AND: case INSTR::BOR: case INSTR::XOR:
+		case INSTR::IFB: case INSTR::IFC: case INSTR::IFE: case INSTR::IFN: case INSTR::IFG: case INSTR::IFA: case INSTR::IFL: case INSTR::IFU:
+		case INSTR::STI: case INSTR::STD:
+			break;
+		case INSTR::SHR: case INSTR::ASR: case INSTR::SHL:
+			if(shift < 0) return false;
+			break;
+		default:
+			return false;
+	}
+
+	const __m256i ones = _mm256_set1_epi16(-1), one = _mm256_set1_epi16(1), bias = _mm256_set1_epi16(-0x8000);
+	const __m128i k = _mm_cvtsi32_si128(shift), up = _mm_cvtsi32_si128(16 - shift), down = _mm_cvtsi32_si128(shift - 16);
+
+	for(size_t i = from; i < to; i += Lanes)
+	{
+		__m256i va = _mm256_loadu_si256((const __m256i*)(a + i));
+		__m256i vb = _mm256_loadu_si256((const __m256i*)(b + i));
+		__m256i o = va, e = _mm256_setzero_si256(), c = _mm256_setzero_si256();
+
+		switch(op)
+		{
+			case INSTR::ADD: o = _mm256_add_epi16(vb, va); e = _mm256_andnot_si256(_mm256_cmpeq_epi16(_mm256_max_epu16(o, vb), o), one); break;
+			case INSTR::SUB: o = _mm256_sub_epi16(vb, va); e = _mm256_xor_si256(_mm256_cmpeq_epi16(_mm256_max_epu16(va, vb), vb), ones); break;
+			case INSTR::MUL: o = _mm256_mullo_epi16(vb, va); e = _mm256_mulhi_epu16(vb, va); break;
+			case INSTR::MLI: o = _mm256_mullo_epi16(vb, va); e = _mm256_mulhi_epi16(vb, va); break;
+			case INSTR::AND: o = _mm256_and_si256(vb, va); break;
+			case INSTR::BOR: o = _mm256_or_si256(vb, va); break;
+			case INSTR::XOR: o = _mm256_xor_si256(vb, va); break;
+			case INSTR::SHL: o = _mm256_sll_epi16(vb, k); e = shift < 16 ? _mm256_srl_epi16(vb, up) : _mm256_sll_epi16(vb, down); break;
+			case INSTR::SHR: o = _mm256_srl_epi16(vb, k); e = shift <= 16 ? _mm256_sll_epi16(vb, up) : _mm256_srl_epi16(vb, down); break;
+			case INSTR::ASR: o = _mm256_sra_epi16(vb, k); e = shift <= 16 ? _mm256_sll_epi16(vb, up) : _mm256_sra_epi16(vb, down); break;
+			case INSTR::IFB: c = _mm256_xor_si256(_mm256_cmpeq_epi16(_mm256_and_si256(vb, va), _mm256_setzero_si256()), ones); break;
+			case INSTR::IFC: c = _mm256_cmpeq_epi16(_mm256_and_si256(vb, va), _mm256_setzero_si256()); break;
+			case INSTR::IFE: c = _mm256_cmpeq_epi16(vb, va); break;
+			case INSTR::IFN: c = _mm256_xor_si256(_mm256_cmpeq_epi16(vb, va), ones); break;
+			case INSTR::IFG: c = _mm256_cmpgt_epi16(_mm256_xor_si256(vb, bias), _mm256_xor_si256(va, bias)); break;
+			case INSTR::IFA: c = _mm256_cmpgt_epi16(vb, va); break;
+			case INSTR::IFL: c = _mm256_cmpgt_epi16(_mm256_xor_si256(va, bias), _mm256_xor_si256(vb, bias)); break;
+			case INSTR::IFU: c = _mm256_cmpgt_epi16(va, vb); break;
+		}
+
+		_mm256_storeu_si256((__m256i*)(out + i), o);
+		_mm256_storeu_si256((__m256i*)(ex + i), e);
+		_mm256_storeu_si256((__m256i*)(cond + i), c);
+	}
+
+	return true;
+}
+
+__attribute__((target("avx2")))
+static void blendAvx2(uint16_t* dst, const uint16_t* src, const uint16_t* mask, size_t from, size_t to)
+{
+	for(size_t i = from; i < to; i += Lanes)
+	{
+		__m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+		__m256i s = _mm256_loadu_si256((const __m256i*)(src + i));
+		__m256i m = _mm256_loadu_si256((const __m256i*)(mask + i));
+		_mm256_storeu_si256((__m256i*)(dst + i), _mm256_blendv_epi8(d, s, m));
+	}
+}
+#endif
+
+Lockstep::Lockstep(const std::vector<uint16_t>& image, size_t count) : count(count), width((count + Lanes - 1) / Lanes * Lanes), avx2(hostHasAvx2())
+{
+	minGroup = std::min(Lanes, count / 4);
+
+	for(auto& r : reg)
+		r.assign(width, 0);
+
+	mem.assign(width << 16, 0);
+	for(size_t i = 0; i < count; i++)
+		std::copy(image.begin(), image.begin() + (long)std::min<size_t>(image.size(), 0x10000), mem.begin() + (long)(i << 16));
+
+	cycle.assign(width, 0);
+	executed.assign(width, 0);
+	status.assign(width, DONE);
+	std::fill_n(status.begin(), count, ACTIVE);
+	mask.assign(width, 0);
+	varies.assign(0x10000, 0);
+
+	for(auto* v : { &va, &vb, &out, &ex, &cond, &addrA, &addrB })
+		v->assign(width, 0);
+}
+
+void Lockstep::poke(size_t vm, uint16_t address, uint16_t value)
+{
+	mem[vm << 16 | address] = value;
+	varies[address] = 1;
+}
+
+void Lockstep::useAvx2(bool on)
+{
+	avx2 = on && hostHasAvx2();
+}
+
+void Lockstep::leave(uint32_t i, uint8_t to)
+{
+	mask[i] = 0;
+	status[i] = to;
+
+	if(to == PARKED)
+	{
+		Waiting& w = parked[reg[PC][i]];
+		if(w.lanes.empty()) w.since = stats.steps;
+		w.lanes.push_back(i);
+	}
+}
+
+void Lockstep::span()
+{
+	size_t first = width, last = 0;
+	for(size_t i = 0; i < width; i++)
+		if(mask[i]) { first = std::min(first, i); last = i; }
+
+	leader = first;
+	begin = first < width ? first / Lanes : 0;
+	end = first < width ? last / Lanes + 1 : 0;
+}
+
+// Finishes a VM on the scalar core, from the state it has now
+void Lockstep::peel(uint32_t i)
+{
+	uint16_t* own = &mem[(size_t)i << 16];
+
+	DCPU16 cpu(std::vector<uint16_t>(own, own + 0x10000));
+	for(unsigned r = 0; r < 12; r++)
+		cpu.reg[r] = reg[r][i];
+	cpu.cycle.store(cycle[i], std::memory_order_relaxed);
+
+	uint64_t n = 0;
+	while(cpu.isRunning() && cpu.cycles() < budget)
+		n += cpu.step(budget);
+
+	for(unsigned r = 0; r < 12; r++)
+		reg[r][i] = cpu.reg[r];
+	// Pages the CPU never wrote still hold what it was given
+	for(unsigned p = 0; p < 0x100; p++)
+		if(cpu.dirty[p]) std::copy(cpu.page[p], cpu.page[p] + DCPU16::PageWords, own + p * DCPU16::PageWords);
+
+	cycle[i] = cpu.cycles();
+	executed[i] += n;
+	stats.scalar += n;
+	stats.peeled++;
+
+	if(mask[i]) leave(i, DONE);
+	status[i] = DONE;
+}
+
+// The word at `address`, as the running group's first lane sees it. Lanes that see something else
+// there (their copy of the code was modified, or poked) are peeled off.
+bool Lockstep::fetch(uint16_t address, uint16_t& word)
+{
+	if(begin == end) return false;
+
+	word = mem[leader << 16 | address];
+	if(!varies[address]) return true;
+
+	bool peeled = false;
+	for(size_t i = leader; i < end * Lanes; i++)
+		if(mask[i] && mem[i << 16 | address] != word) { peel((uint32_t)i); peeled = true; }
+
+	if(peeled) span();
+	return true;
+}
+
+// Where a lane resumes when the IF before `address` fails, and the cycles the skipping costs
+uint16_t Lockstep::skip(uint16_t address, unsigned& cost)
+{
+	cost = 0;
+	for(;;)
+	{
+		uint16_t inst;
+		if(!fetch(address, inst)) return address;
+
+		uint16_t aa = (inst >> 10) & 0x3f, bb = (inst >> 5) & 0x1f, op = inst & 0x1f;
+		unsigned words = operand_cycles(aa) + (op == INSTR::NBI ? 0 : operand_cycles(bb));
+
+		address = (uint16_t)(address + 1 + words);
+		cost += words;
+
+		if(op < INSTR::IFB || op > INSTR::IFU) return address;
+		cost++;
+	}
+}
+
+// Mirrors DCPU16::value(): side effects on SP happen here, in operand order; values are read later
+Lockstep::Location Lockstep::resolve(uint16_t v, bool isA, uint16_t& next, std::vector<uint16_t>& addr)
+{
+	const size_t from = begin * Lanes, to = end * Lanes;
+	Location loc = { Location::LITERAL, 0, 0 };
+
+	if(v >= 0x20) { loc.literal = (uint16_t)(v - 0x21); return loc; }
+
+	uint16_t* sp = reg[SP].data();
+	if(v == 0x18)
+	{
+		for(size_t i = from; i < to; i++)
+			if(mask[i]) addr[i] = isA ? sp[i]++ : --sp[i];
+
+		loc.kind = Location::MEMORY;
+		return loc;
+	}
+
+	const uint8_t specs = reg_specs[v];
+	const unsigned r = specs & 0xFu;
+	uint16_t word = 0;
+
+	if(specs & IMM) // the same in every lane: step() made sure before anything changed
+		word = mem[leader << 16 | next++];
+
+	if(specs & MEM)
+	{
+		const uint16_t* base = r != NOREG ? reg[r].data() : nullptr;
+		for(size_t i = from; i < to; i++)
+			if(mask[i]) addr[i] = (uint16_t)((base ? base[i] : 0) + word);
+
+		loc.kind = Location::MEMORY;
+	}
+	else if(specs & IMM)
+		loc.literal = word;
+	else
+	{
+		loc.kind = Location::REGISTER;
+		loc.index = r;
+	}
+
+	return loc;
+}
+
+void Lockstep::load(const Location& loc, const std::vector<uint16_t>& addr, std::vector<uint16_t>& dst)
+{
+	const size_t from = begin * Lanes, to = end * Lanes;
+
+	switch(loc.kind)
+	{
+		case Location::LITERAL:  std::fill(dst.begin() + (long)from, dst.begin() + (long)to, loc.literal); break;
+		case Location::REGISTER: std::copy(reg[loc.index].begin() + (long)from, reg[loc.index].begin() + (long)to, dst.begin() + (long)from); break;
+		case Location::MEMORY:
+			for(size_t i = from; i < to; i++)
+				if(mask[i]) dst[i] = mem[i << 16 | addr[i]];
+			break;
+	}
+}
+
+void Lockstep::store(const Location& loc, const std::vector<uint16_t>& addr, const std::vector<uint16_t>& src)
+{
+	const size_t from = begin * Lanes, to = end * Lanes;
+
+	switch(loc.kind)
+	{
+		case Location::LITERAL: break; // writes to literals are lost
+		case Location::REGISTER: blend(reg[loc.index], src); break;
+		case Location::MEMORY:
+			for(size_t i = from; i < to; i++)
+				if(mask[i]) { mem[i << 16 | addr[i]] = src[i]; varies[addr[i]] = 1; }
+			break;
+	}
+}
+
+// dst = src in the running group's lanes
+void Lockstep::blend(std::vector<uint16_t>& dst, const std::vector<uint16_t>& src)
+{
+	const size_t from = begin * Lanes, to = end * Lanes;
+
+#ifdef DCPU_LOCKSTEP_AVX2
+	if(avx2) return blendAvx2(dst.data(), src.data(), mask.data(), from, to);
+#endif
+
+	for(size_t i = from; i < to; i++)
+		dst[i] = mask[i] ? src[i] : dst[i];
+}
+
+// va (and vb) to out, ex and cond for every lane in range
+bool Lockstep::compute(unsigned op, int shift)
+{
+	const size_t from = begin * Lanes, to = end * Lanes;
+
+#ifdef DCPU_LOCKSTEP_AVX2
+	if(avx2 && computeAvx2(op, shift, va.data(), vb.data(), out.data(), ex.data(), cond.data(), from, to)) return true;
+#else
+	(void)shift;
+#endif
+
+	const uint16_t* e = reg[EX].data();
+	for(size_t i = from; i < to; i++)
+		if(mask[i]) lane(op, va[i], vb[i], e[i], out[i], ex[i], cond[i]);
+
+	return true;
+}
+
+// Executes the instruction at `pc` in every lane of the running group
+void Lockstep::step()
+{
+	uint16_t inst;
+	if(!fetch(pc, inst)) return;
+
+	uint16_t aa = (inst >> 10) & 0x3f;
+	uint16_t bb = (inst >>  5) & 0x1f;
+	uint16_t op = (inst >>  0) & 0x1f;
+
+	// Interrupts, hardware and unknown opcodes are the scalar core's business
+	bool invalid = op == 0x18 || op == 0x19 || op == 0x1c || op == 0x1d;
+	if((op == INSTR::NBI && bb != NBI::JSR) || invalid)
+	{
+		for(size_t i = begin * Lanes; i < end * Lanes; i++)
+			if(mask[i]) peel((uint32_t)i);
+		return span();
+	}
+
+	// Every word this instruction reads, and the skip target if it is an IF, must agree between the
+	// lanes before anything changes: a lane found to disagree is peeled from its state as it is now
+	uint16_t next = (uint16_t)(pc + 1), word;
+	unsigned words = operand_cycles(aa) + (op == INSTR::NBI ? 0 : operand_cycles(bb));
+	for(unsigned w = 0; w < words; w++)
+		if(!fetch((uint16_t)(next + w), word)) return;
+
+	unsigned skipCost = 0;
+	uint16_t skipTo = 0;
+	if(op >= INSTR::IFB && op <= INSTR::IFU) skipTo = skip((uint16_t)(next + words), skipCost);
+	if(begin == end) return;
+
+	const size_t from = begin * Lanes, to = end * Lanes;
+
+	Location a = resolve(aa, true, next, addrA);
+	Location b = op == INSTR::NBI ? Location{ Location::LITERAL, 0, 0 } : resolve(bb, false, next, addrB);
+
+	unsigned cost = words + (op == INSTR::NBI ? special_cycles[bb] : basic_cycles[op]);
+	uint16_t* pcs = reg[PC].data();
+	for(size_t i = from; i < to; i++)
+		if(mask[i]) { pcs[i] = next; cycle[i] += cost; executed[i]++; stats.lanes++; }
+
+	stats.steps++;
+
+	if(op == INSTR::NBI) // JSR: the push comes before `a` is read, as in DCPU16::execute()
+	{
+		uint16_t* sp = reg[SP].data();
+		for(size_t i = from; i < to; i++)
+			if(mask[i]) { --sp[i]; mem[i << 16 | sp[i]] = pcs[i]; varies[sp[i]] = 1; }
+
+		load(a, addrA, va);
+		return blend(reg[PC], va);
+	}
+
+	load(a, addrA, va);
+	if(op != INSTR::SET && op != INSTR::STI && op != INSTR::STD) load(b, addrB, vb);
+
+	int shift = a.kind == Location::LITERAL && a.literal < 32 ? a.literal : -1;
+	compute(op, shift);
+
+	if(op >= INSTR::IFB && op <= INSTR::IFU)
+	{
+		for(size_t i = from; i < to; i++)
+			if(mask[i] && !cond[i]) { pcs[i] = skipTo; cycle[i] += skipCost; }
+		return;
+	}
+
+	store(b, addrB, out);
+
+	switch(op)
+	{
+		case INSTR::MOD: case INSTR::MDI: case INSTR::AND: case INSTR::BOR: case INSTR::XOR: case INSTR::SET:
+			break;
+		case INSTR::STI: case INSTR::STD:
+			for(size_t i = from; i < to; i++)
+				if(mask[i])
+				{
+					uint16_t d = op == INSTR::STI ? 1 : 0xFFFF;
+					reg[I][i] = (uint16_t)(reg[I][i] + d);
+					reg[J][i] = (uint16_t)(reg[J][i] + d);
+				}
+			break;
+		default:
+			blend(reg[EX], ex);
+			break;
+	}
+}
+
+// After a step: retires lanes out of cycles, and keeps the lanes at the lowest PC running while the
+// others wait to be caught up with
+void Lockstep::regroup()
+{
+	const size_t from = begin * Lanes, to = end * Lanes;
+	const uint16_t* pcs = reg[PC].data();
+	bool any = false, diverged = false, changed = false;
+	uint16_t low = 0;
+	size_t running = 0;
+
+	for(size_t i = from; i < to; i++)
+	{
+		if(!mask[i]) continue;
+		if(cycle[i] >= budget) { leave((uint32_t)i, DONE); changed = true; continue; }
+
+		running++;
+		if(!any) { low = pcs[i]; any = true; }
+		else if(pcs[i] != low) { diverged = true; low = std::min(low, pcs[i]); }
+	}
+
+	if(diverged)
+	{
+		for(size_t i = from; i < to; i++)
+			if(mask[i] && pcs[i] != low) { leave((uint32_t)i, PARKED); running--; }
+		changed = true;
+	}
+
+	// Lanes waiting further back go first: they may be on their way here
+	if(any && !parked.empty() && parked.begin()->first < low)
+	{
+		for(size_t i = from; i < to; i++)
+			if(mask[i]) leave((uint32_t)i, PARKED);
+
+		any = false;
+		running = 0;
+		changed = true;
+	}
+
+	pc = low;
+
+	auto waiting = parked.find(pc);
+	if(any && waiting != parked.end())
+	{
+		for(uint32_t i : waiting->second.lanes) { mask[i] = 0xFFFF; status[i] = ACTIVE; }
+		running += waiting->second.lanes.size();
+		parked.erase(waiting);
+		changed = true;
+	}
+
+	// Someone has to give way: a small group holding up a larger one for a while, or either side of a
+	// wait that went on for too long (whichever has fewer lanes)
+	bool giveWay = false;
+	for(auto it = parked.begin(); it != parked.end(); )
+	{
+		uint64_t waited = stats.steps - it->second.since;
+		bool larger = it->second.lanes.size() > running;
+
+		if(any && larger && (waited > maxWait || (running < minGroup && waited > maxWait / 16))) giveWay = true;
+		else if(waited > maxWait && !larger)
+		{
+			for(uint32_t i : it->second.lanes) peel(i);
+			it = parked.erase(it);
+			continue;
+		}
+
+		++it;
+	}
+
+	if(giveWay)
+	{
+		for(size_t i = from; i < to; i++)
+			if(mask[i]) peel((uint32_t)i);
+		changed = true;
+	}
+
+	if(changed) span();
+}
+
+// With no group running, the lanes waiting at the lowest PC go next
+void Lockstep::select()
+{
+	auto first = parked.begin();
+	for(uint32_t i : first->second.lanes) { mask[i] = 0xFFFF; status[i] = ACTIVE; }
+
+	pc = first->first;
+	parked.erase(first);
+	span();
+}
+
+void Lockstep::run(uint64_t cycles)
+{
+	budget = cycles;
+
+	for(size_t i = 0; i < count; i++)
+		if(status[i] == ACTIVE) mask[i] = 0xFFFF;
+
+	span();
+	regroup();
+
+	for(;;)
+	{
+		if(begin == end)
+		{
+			if(parked.empty()) break;
+			select();
+			continue;
+		}
+
+		step();
+		regroup();
+	}
+}
@@ -0,0 +1,222 @@
+#include <algorithm>
+#include <cstdio>
+#include <map>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "dcpu16.h"
+#include "m35fd.h"
+
+// Drive mechanics, in CPU cycles at 100 kHz: 2.4 ms to step one track,
+// 512 words at 30700 words/s per sector, 18 sectors to a track
+static const uint64_t SeekCycles = 240, TransferCycles = 1668;
+static const unsigned SectorsPerTrack = 18;
+
+// How long to wait before looking again when the host is slower than the drive
+static const uint64_t RetryCycles = 100;
+
+DiskImage::~DiskImage()
+{
+#ifndef _WIN32
+	if(data) munmap(data, size);
+#endif
+}
+
+std::shared_ptr<DiskImage> DiskImage::open(const std::string& path, bool writable)
+{
+#ifdef _WIN32
+	std::fprintf(stderr, "%s: disk images are not supported on this platform\n", path.c_str());
+	return nullptr;
+#else
+	int fd = writable ? ::open(path.c_str(), O_RDWR | O_CREAT, 0644) : ::open(path.c_str(), O_RDONLY);
+	if(fd < 0) return nullptr;
+
+	const size_t full = (size_t)Sectors * SectorWords * 2;
+	struct stat info;
+	size_t size = fstat(fd, &info) < 0 ? 0 : (size_t)info.st_size;
+
+	if(writable && size < full)
+	{
+		if(ftruncate(fd, (off_t)full) < 0) { close(fd); return nullptr; }
+		size = full;
+	}
+
+	std::shared_ptr<DiskImage> image(new DiskImage(writable));
+	image->size = std::min(size, full);
+
+	if(image->size)
+	{
+		void* p = mmap(nullptr, image->size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+		if(p == MAP_FAILED) { close(fd); return nullptr; }
+		image->data = (uint8_t*)p;
+	}
+
+	close(fd); // the mapping keeps the file
+	return image;
+#endif
+}
+
+std::shared_ptr<DiskImage> DiskImage::shared(const std::string& path)
+{
+	static std::mutex lock;
+	static std::map<std::string, std::weak_ptr<DiskImage>> images;
+
+	std::lock_guard<std::mutex> guard(lock);
+
+	std::shared_ptr<DiskImage> image = images[path].lock();
+	if(!image && (image = open(path, false))) images[path] = image;
+
+	return image;
+}
+
+void DiskImage::read(unsigned sector, uint16_t* words) const
+{
+	size_t offset = (size_t)sector * SectorWords * 2;
+	for(unsigned i = 0; i < SectorWords; i++, offset += 2)
+		words[i] = offset + 1 < size ? (uint16_t)(data[offset] | data[offset + 1] << 8) : 0;
+}
+
+void DiskImage::write(unsigned sector, const uint16_t* words)
+{
+	if(!writable) return;
+
+	size_t offset = (size_t)sector * SectorWords * 2;
+	for(unsigned i = 0; i < SectorWords && offset + 1 < size; i++, offset += 2)
+	{
+		data[offset + 0] = (uint8_t)(words[i] & 0xFF);
+		data[offset + 1] = (uint8_t)(words[i] >> 8);
+	}
+}
+
+M35FD::M35FD(DCPU16* c, std::shared_ptr<DiskImage> disk) : Hardware(c, 0x4fd524c5, 0x000b, 0x1eb37e91)
+{
+	ticking = false;
+	if(disk) insert(disk);
+}
+
+M35FD::~M35FD()
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		quitting = true;
+	}
+
+	wakeup.notify_all();
+	if(worker.joinable()) worker.join();
+}
+
+void M35FD::update(uint16_t newState, uint16_t newError)
+{
+	bool changed = newState != state || newError != error;
+	state = newState;
+	error = newError;
+
+	if(changed && irq) cpu->interrupt(irq, true);
+}
+
+void M35FD::insert(std::shared_ptr<DiskImage> disk)
+{
+	if(media) eject();
+
+	media = disk;
+	if(media) update(media->isWritable() ? STATE_READY : STATE_READY_WP, error);
+}
+
+void M35FD::eject()
+{
+	// A transfer in progress is abandoned; the I/O thread still finishes it with its own reference to the image
+	if(state == STATE_BUSY)
+	{
+		cpu->schedule(this, UINT64_MAX);
+		update(STATE_NO_MEDIA, ERROR_EJECT);
+	}
+	else
+		update(STATE_NO_MEDIA, error);
+
+	media.reset();
+}
+
+void M35FD::start(bool write)
+{
+	uint16_t s = cpu->reg[X];
+	cpu->reg[B] = 0;
+
+	if(state == STATE_BUSY || inFlight.load(std::memory_order_acquire)) return update(state, ERROR_BUSY);
+	if(state == STATE_NO_MEDIA) return update(state, ERROR_NO_MEDIA);
+	if(s >= DiskImage::Sectors) return update(state, ERROR_BAD_SECTOR);
+	if(write && state == STATE_READY_WP) return update(state, ERROR_PROTECTED);
+
+	sector = s;
+	address = cpu->reg[Y];
+	writing = write;
+	target = media;
+
+	if(write)
+		for(unsigned i = 0; i < DiskImage::SectorWords; i++)
+			staging[i] = cpu->read((uint16_t)(address + i));
+
+	unsigned to = s / SectorsPerTrack;
+	uint64_t latency = SeekCycles * (to > track ? to - track : track - to) + TransferCycles;
+	track = to;
+
+	inFlight.store(true, std::memory_order_relaxed);
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		requested = true;
+		if(!worker.joinable()) worker = std::thread(&M35FD::work, this);
+	}
+	wakeup.notify_one();
+
+	cpu->schedule(this, cpu->cycles() + latency);
+	cpu->reg[B] = 1;
+	update(STATE_BUSY, error);
+}
+
+void M35FD::work()
+{
+	std::unique_lock<std::mutex> guard(lock);
+
+	for(;;)
+	{
+		wakeup.wait(guard, [this]() { return requested || quitting; });
+		if(!requested) return;
+		requested = false;
+
+		guard.unlock();
+		if(writing) target->write(sector, staging);
+		else target->read(sector, staging);
+		inFlight.store(false, std::memory_order_release);
+		guard.lock();
+	}
+}
+
+void M35FD::wake()
+{
+	if(state != STATE_BUSY) return;
+
+	// The guest-visible time is up; never block the CPU on the host, just look again a little later
+	if(inFlight.load(std::memory_order_acquire)) { cpu->schedule(this, cpu->cycles() + RetryCycles); return; }
+
+	if(!writing)
+		for(unsigned i = 0; i < DiskImage::SectorWords; i++)
+			cpu->store((uint16_t)(address + i), staging[i]);
+
+	target.reset();
+	update(media->isWritable() ? STATE_READY : STATE_READY_WP, error);
+}
+
+void M35FD::interrupt()
+{
+	switch(cpu->reg[A])
+	{
+		case 0: cpu->reg[B] = state; cpu->reg[C] = error; error = ERROR_NONE; break;
+		case 1: irq = cpu->reg[X]; break;
+		case 2: start(false); break;
+		case 3: start(true); break;
+	}
+}
@@ -0,0 +1,97 @@
+#include <algorithm>
+#include <thread>
+
+#include "dcpu16.h"
+#include "mailbox.h"
+
+void Mailbox::connect(Mailbox& a, unsigned pa, Mailbox& b, unsigned pb, size_t capacity)
+{
+	if(a.ports.size() <= pa) a.ports.resize(pa + 1, Port{ nullptr, nullptr, nullptr });
+	if(b.ports.size() <= pb) b.ports.resize(pb + 1, Port{ nullptr, nullptr, nullptr });
+
+	auto ab = std::make_shared<Ring>(capacity), ba = std::make_shared<Ring>(capacity);
+	a.ports[pa] = Port{ ab, ba, &b };
+	b.ports[pb] = Port{ ba, ab, &a };
+}
+
+void Mailbox::send()
+{
+	uint16_t port = cpu->reg[B], address = cpu->reg[C];
+	cpu->reg[C] = 0;
+	if(port >= ports.size() || !ports[port].out || !cpu->reg[X]) return;
+
+	Message m;
+	m.length = std::min<uint16_t>(cpu->reg[X], MaxWords);
+	for(uint16_t n = 0; n < m.length; n++)
+		m.words[n] = cpu->read((uint16_t)(address + n));
+
+	if(!ports[port].out->push(m))
+	{
+		// The guest will retry; give the receiver's thread a chance to run if it shares our core
+		std::this_thread::yield();
+		return;
+	}
+
+	// Only touch the peer's doorbell line when it is not already rung. The fence pairs with the
+	// receiver's exchange: either it sees the message after clearing the bell, or this sees it cleared.
+	auto& rung = ports[port].peer->doorbell.rung;
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if(!rung.load(std::memory_order_relaxed)) rung.store(true, std::memory_order_release);
+
+	cpu->reg[C] = 1;
+	cpu->tick(m.length);
+	sent++;
+}
+
+void Mailbox::receive()
+{
+	uint16_t port = cpu->reg[B], address = cpu->reg[C];
+	cpu->reg[X] = 0;
+
+	Message m;
+	size_t n = ports.size();
+	for(size_t i = 0; i < n; i++)
+	{
+		size_t p = port == 0xFFFF ? (nextPort + i) % n : port;
+		if(p < n && ports[p].in && ports[p].in->pop(m))
+		{
+			for(uint16_t w = 0; w < m.length; w++)
+				cpu->store((uint16_t)(address + w), m.words[w]);
+
+			cpu->reg[X] = m.length;
+			cpu->reg[B] = (uint16_t)p;
+			cpu->tick(m.length);
+			nextPort = (unsigned)(p + 1);
+			received++;
+			return;
+		}
+
+		if(port != 0xFFFF) return;
+	}
+}
+
+void Mailbox::interrupt()
+{
+	switch(cpu->reg[A])
+	{
+		case 0: send(); break;
+		case 1: receive(); break;
+		case 2: irq = cpu->reg[B]; break;
+		case 3:
+			cpu->reg[X] = 0xFFFF;
+			for(size_t p = ports.size(); p-- > 0; )
+				if(ports[p].in && !ports[p].in->empty()) cpu->reg[X] = (uint16_t)p;
+
+			cpu->reg[B] = (uint16_t)ports.size();
+			cpu->reg[C] = node;
+			break;
+	}
+}
+
+void Mailbox::tick(unsigned int)
+{
+	// Peers only set the flag; the interrupt itself is raised here, on this CPU's thread.
+	// While interrupts are off the doorbell stays rung, so enabling them reports earlier arrivals.
+	if(irq && doorbell.rung.load(std::memory_order_relaxed) && doorbell.rung.exchange(false, std::memory_order_seq_cst))
+		cpu->interrupt(irq, true);
+}
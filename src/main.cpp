@@ -1,4 +1,7 @@
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
 #include <sys/stat.h>
 #include <string>
 #include <vector>
@@ -6,18 +9,64 @@
 #include "dcpu16.h"
 #include "assembler.h"
 #include "lem1802.h"
+#include "window.h"
+#include "capture.h"
+#include "sharedscreen.h"
 #include "keyboard.h"
 #include "clock.h"
+#include "m35fd.h"
+#include "metrics.h"
+#include "perfcounter.h"
+#include "events.h"
 
 int main(int argc, char* argv[])
 {
-	if(argc <= 2) return printf("Usage:\t./dcpu <program file> <delay>\n");
+	std::vector<const char*> args;
+	std::string metricsTarget, floppy, capture, exportName;
+	unsigned metricsInterval = 1000;
+	bool floppyReadOnly = false;
+	Capture::Options captureOptions;
+
+	for(int i = 1; i < argc; i++)
+	{
+		if(!strcmp(argv[i], "--metrics") && i + 1 < argc) metricsTarget = argv[++i];
+		else if(!strcmp(argv[i], "--metrics-interval") && i + 1 < argc) metricsInterval = (unsigned)atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--floppy") && i + 1 < argc) floppy = argv[++i];
+		else if(!strcmp(argv[i], "--floppy-ro") && i + 1 < argc) { floppy = argv[++i]; floppyReadOnly = true; }
+		else if(!strcmp(argv[i], "--capture") && i + 1 < argc) capture = argv[++i];
+		else if(!strcmp(argv[i], "--frame-hashes") && i + 1 < argc) captureOptions.hashLog = argv[++i];
+		else if(!strcmp(argv[i], "--capture-dedup")) captureOptions.dedup = true;
+		else if(!strcmp(argv[i], "--vram-export") && i + 1 < argc) exportName = argv[++i];
+		else args.push_back(argv[i]);
+	}
+
+	// --capture <raw|y4m|png>:<path>
+	size_t colon = capture.find(':');
+	if(colon != std::string::npos)
+	{
+		captureOptions.format = Capture::parseFormat(capture.substr(0, colon));
+		captureOptions.path = capture.substr(colon + 1);
+	}
+
+	bool badCapture = !capture.empty() && (captureOptions.format == Capture::NONE || captureOptions.path.empty());
+
+	if(args.size() < 2 || badCapture)
+		return printf("Usage:\t./dcpu [--metrics <file | unix:socket path>] [--metrics-interval <ms>] [--floppy | --floppy-ro <disk image>]\n"
+			"\t      [--capture <raw|y4m|png>:<path>] [--capture-dedup] [--frame-hashes <file>]\n"
+			"\t      [--vram-export <shm name>] <program file> <delay>\n");
+
+	std::shared_ptr<DiskImage> disk;
+	if(!floppy.empty() && !(disk = floppyReadOnly ? DiskImage::shared(floppy) : DiskImage::open(floppy, true)))
+	{
+		perror(floppy.c_str());
+		return 1;
+	}
 
 	struct stat info;
-	uint64_t size = stat(argv[1], &info) < 0 ? 0 : (uint64_t)info.st_size;
+	uint64_t size = stat(args[0], &info) < 0 ? 0 : (uint64_t)info.st_size;
 	std::string buff(size, '\0');
 
-	FILE* file = fopen(argv[1], "rb");
+	FILE* file = fopen(args[0], "rb");
 
 	if (!file) return 0;
 
@@ -26,13 +75,44 @@ int main(int argc, char* argv[])
 
 	std::vector<uint16_t> mem = Assembler(buff);
 
-	uint16_t delay = (uint16_t)atoi(argv[2]);
+	uint16_t delay = (uint16_t)atoi(args[1]);
+
+	Metrics metrics;
+	if(!metricsTarget.empty()) metrics.publish(metricsTarget, metricsInterval);
 
 	DCPU16* cpu = new DCPU16(mem);
-	cpu->installHardware(new LEM1802(cpu, delay));
-	cpu->installHardware(new Keyboard(cpu));
+	if(!metricsTarget.empty()) cpu->attachMetrics(&metrics);
+	LEM1802* screen = new LEM1802(cpu, delay);
+	Keyboard* keyboard = new Keyboard(cpu);
+	Window window(metricsTarget.empty() ? nullptr : &metrics);
+	screen->attach(&window);
+
+	std::unique_ptr<Capture> recorder;
+	if(!capture.empty() || !captureOptions.hashLog.empty())
+	{
+		recorder.reset(new Capture(captureOptions));
+		if(!recorder->ok()) { perror("capture"); return 1; }
+		screen->attach(recorder.get());
+	}
+
+	std::unique_ptr<SharedScreen> shared(exportName.empty() ? nullptr : SharedScreen::create(exportName));
+	if(!exportName.empty() && !shared) { perror(exportName.c_str()); return 1; }
+	if(shared) screen->attach(shared.get());
+
+	cpu->installHardware(screen);
+	cpu->installHardware(keyboard);
 	cpu->installHardware(new Clock(cpu));
-	cpu->run();
+	cpu->installHardware(new M35FD(cpu, disk));
+	cpu->installHardware(new PerfCounter(cpu));
+
+	runInteractive(*cpu, &window, keyboard, [cpu]() { cpu->run(); });
+
+	if(recorder)
+	{
+		recorder->close();
+		printf("capture: %llu frames, %llu written, %llu dropped\n", (unsigned long long)recorder->framesReceived(),
+			(unsigned long long)recorder->framesWritten(), (unsigned long long)recorder->framesDropped());
+	}
 
 	delete cpu;
 
@@ -0,0 +1,142 @@
+#include <cstdio>
+#include <cstring>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "metrics.h"
+
+void Histogram::record(uint64_t v)
+{
+	unsigned b = 0;
+	for(uint64_t x = v; x; x >>= 1) b++;
+
+	buckets[b].fetch_add(1, std::memory_order_relaxed);
+	count.fetch_add(1, std::memory_order_relaxed);
+	sum.fetch_add(v, std::memory_order_relaxed);
+
+	uint64_t m = max.load(std::memory_order_relaxed);
+	while(v > m && !max.compare_exchange_weak(m, v, std::memory_order_relaxed)) {}
+}
+
+std::string Histogram::json() const
+{
+	uint64_t n = count.load(std::memory_order_relaxed), total = sum.load(std::memory_order_relaxed);
+	uint64_t p50 = 0, p99 = 0, seen = 0;
+
+	for(unsigned b = 0; b < 65 && n; b++)
+	{
+		seen += buckets[b].load(std::memory_order_relaxed);
+		uint64_t upper = b == 0 ? 0 : b == 64 ? UINT64_MAX : (1ull << b) - 1;
+		if(!p50 && seen * 2 >= n) p50 = upper;
+		if(!p99 && seen * 100 >= n * 99) { p99 = upper; break; }
+	}
+
+	char line[160];
+	std::snprintf(line, sizeof(line), "{\"count\":%llu,\"mean\":%.1f,\"p50\":%llu,\"p99\":%llu,\"max\":%llu}",
+		(unsigned long long)n, n ? (double)total / (double)n : 0.0, (unsigned long long)p50, (unsigned long long)p99,
+		(unsigned long long)max.load(std::memory_order_relaxed));
+	return line;
+}
+
+Metrics::~Metrics()
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+	}
+
+	wakeup.notify_all();
+	if(publisher.joinable()) publisher.join();
+}
+
+bool Metrics::publish(const std::string& target, unsigned intervalMs)
+{
+	if(publisher.joinable() || target.empty()) return false;
+
+#ifdef _WIN32
+	if(target.compare(0, 5, "unix:") == 0)
+	{
+		std::fprintf(stderr, "metrics: local sockets are not supported on this platform\n");
+		return false;
+	}
+#endif
+
+	publisher = std::thread(&Metrics::loop, this, target, intervalMs ? intervalMs : 1);
+	return true;
+}
+
+std::string Metrics::json(double elapsed, uint64_t dInstructions, uint64_t dCycles, double dt) const
+{
+	char line[320];
+
+	// The DCPU-16 runs at 100 kHz: emulated seconds per real second
+	std::snprintf(line, sizeof(line),
+		"{\"t\":%.3f,\"instructions\":%llu,\"cycles\":%llu,\"instructions_per_s\":%.0f,\"cycles_per_s\":%.0f,"
+		"\"realtime_ratio\":%.3f,\"irq_queue_depth\":%llu,\"keyboard_events\":%llu,",
+		elapsed, (unsigned long long)instructions.get(), (unsigned long long)cycles.get(),
+		(double)dInstructions / dt, (double)dCycles / dt, (double)dCycles / 100000.0 / dt,
+		(unsigned long long)irqQueueDepth.load(std::memory_order_relaxed), (unsigned long long)keyboardEvents.get());
+
+	return line + ("\"irq_depth\":" + irqDepth.json() + ",\"irq_latency_cycles\":" + irqLatency.json() +
+		",\"lem_rasterize_us\":" + lemRasterize.json() + ",\"lem_present_us\":" + lemPresent.json() + "}");
+}
+
+void Metrics::loop(std::string target, unsigned intervalMs)
+{
+	typedef std::chrono::steady_clock clock;
+
+	bool socket = target.compare(0, 5, "unix:") == 0;
+	FILE* file = nullptr;
+	int fd = -1;
+
+	auto start = clock::now(), last = start;
+	uint64_t lastInstructions = 0, lastCycles = 0;
+
+	std::unique_lock<std::mutex> guard(lock);
+	while(!wakeup.wait_for(guard, std::chrono::milliseconds(intervalMs), [this]() { return stopping; }))
+	{
+		auto now = clock::now();
+		uint64_t i = instructions.get(), c = cycles.get();
+		std::string line = json(std::chrono::duration<double>(now - start).count(), i - lastInstructions, c - lastCycles,
+			std::chrono::duration<double>(now - last).count()) + "\n";
+		last = now; lastInstructions = i; lastCycles = c;
+
+		if(!socket)
+		{
+			if(!file && !(file = std::fopen(target.c_str(), "ab"))) { std::perror(target.c_str()); return; }
+			std::fwrite(line.data(), 1, line.size(), file);
+			std::fflush(file);
+			continue;
+		}
+
+#ifndef _WIN32
+		// Nobody listening yet (or any more): drop this sample and try again next time
+		if(fd < 0)
+		{
+			sockaddr_un addr;
+			memset(&addr, 0, sizeof(addr));
+			addr.sun_family = AF_UNIX;
+			std::strncpy(addr.sun_path, target.c_str() + 5, sizeof(addr.sun_path) - 1);
+
+			fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+			if(fd >= 0 && connect(fd, (const sockaddr*)&addr, sizeof(addr)) < 0) { close(fd); fd = -1; }
+		}
+
+#ifdef MSG_NOSIGNAL
+		const int flags = MSG_NOSIGNAL;
+#else
+		const int flags = 0;
+#endif
+		if(fd >= 0 && send(fd, line.data(), line.size(), flags) != (ssize_t)line.size()) { close(fd); fd = -1; }
+#endif
+	}
+
+	if(file) std::fclose(file);
+#ifndef _WIN32
+	if(fd >= 0) close(fd);
+#endif
+}
@@ -0,0 +1,109 @@
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+
+#include "pages.h"
+
+// Read-only data: a stray write through the page table faults instead of corrupting every CPU's memory
+static const uint16_t zero[PageImage::PageWords] = {};
+
+const uint16_t* PageImage::zeroPage()
+{
+	return zero;
+}
+
+namespace
+{
+	// Images by hash; entries of images no CPU holds any more are swept out as the table grows
+	std::mutex lock;
+	std::unordered_multimap<uint64_t, std::weak_ptr<const PageImage>> images;
+	size_t sweepAt = 64;
+}
+
+// Program size without its trailing zeros
+static size_t trimmed(const std::vector<uint16_t>& prog)
+{
+	size_t size = std::min<size_t>(prog.size(), 0x10000);
+	while(size > 0 && prog[size - 1] == 0) size--;
+	return size;
+}
+
+bool PageImage::holds(const std::vector<uint16_t>& prog) const
+{
+	size_t size = trimmed(prog);
+
+	for(unsigned p = 0; p < Pages; p++)
+	{
+		size_t begin = p * PageWords, end = std::min<size_t>(begin + PageWords, size);
+		const uint16_t* page = pages[p];
+
+		if(begin >= end) { if(page != zero) return false; }
+		else if(memcmp(page, &prog[begin], (end - begin) * sizeof(uint16_t)) ||
+			!std::all_of(page + (end - begin), page + PageWords, [](uint16_t w) { return w == 0; })) return false;
+	}
+
+	return true;
+}
+
+std::shared_ptr<const PageImage> PageImage::intern(const std::vector<uint16_t>& prog)
+{
+	size_t size = trimmed(prog);
+
+	// FNV-1a over the words
+	uint64_t h = 0xcbf29ce484222325ull;
+	for(size_t i = 0; i < size; i++)
+		h = (h ^ prog[i]) * 0x100000001b3ull;
+
+	// Images that turn out to be different are released only after the lock: their last owner may be here
+	std::vector<std::shared_ptr<const PageImage>> seen;
+
+	std::lock_guard<std::mutex> guard(lock);
+
+	auto range = images.equal_range(h);
+	for(auto it = range.first; it != range.second; ++it)
+	{
+		std::shared_ptr<const PageImage> image = it->second.lock();
+		if(!image) continue;
+
+		if(image->holds(prog)) return image;
+		seen.push_back(image);
+	}
+
+	std::shared_ptr<PageImage> image(new PageImage());
+
+	unsigned stored = 0;
+	for(size_t begin = 0; begin < size; begin += PageWords)
+	{
+		size_t end = std::min<size_t>(begin + PageWords, size);
+		stored += std::any_of(&prog[begin], &prog[0] + end, [](uint16_t w) { return w != 0; });
+	}
+
+	image->words.assign(stored * PageWords, 0);
+
+	unsigned next = 0;
+	for(unsigned p = 0; p < Pages; p++)
+	{
+		size_t begin = p * PageWords, end = std::min<size_t>(begin + PageWords, size);
+		bool empty = begin >= end || std::all_of(&prog[begin], &prog[0] + end, [](uint16_t w) { return w == 0; });
+
+		if(empty) image->pages[p] = zero;
+		else
+		{
+			uint16_t* page = &image->words[next++ * PageWords];
+			std::copy(&prog[begin], &prog[0] + end, page);
+			image->pages[p] = page;
+		}
+	}
+
+	if(images.size() >= sweepAt)
+	{
+		for(auto it = images.begin(); it != images.end(); )
+			it = it->second.expired() ? images.erase(it) : std::next(it);
+
+		sweepAt = std::max<size_t>(64, 2 * images.size());
+	}
+
+	images.emplace(h, image);
+	return image;
+}
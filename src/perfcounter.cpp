@@ -0,0 +1,59 @@
+#include <algorithm>
+
+#include "dcpu16.h"
+#include "perfcounter.h"
+
+// Cycles since the counters were zeroed, before wrapping to 48 bits
+uint64_t PerfCounter::elapsed() const
+{
+	return cpu->cycles() - cycleBase;
+}
+
+void PerfCounter::put(uint64_t count)
+{
+	cpu->reg[B] = (uint16_t)count;
+	cpu->reg[C] = (uint16_t)(count >> 16);
+	cpu->reg[X] = (uint16_t)((count >> 32) & 0xFFFF);
+}
+
+void PerfCounter::reschedule()
+{
+	// As with the Clock, only interrupts need the CPU to wake us up
+	if(irq)
+		cpu->schedule(this, cycleBase + ((fired + 1) << bits));
+	else
+		cpu->schedule(this, UINT64_MAX);
+}
+
+void PerfCounter::interrupt()
+{
+	switch(cpu->reg[A])
+	{
+		case 0:
+			cycleBase = cpu->cycles();
+			instructionBase = cpu->instructions();
+			interruptBase = cpu->interruptsTaken();
+			fired = 0;
+			break;
+
+		case 1: put(elapsed()); break;
+		case 2: put(cpu->instructions() - instructionBase); break;
+		case 3: put(cpu->interruptsTaken() - interruptBase); break;
+
+		case 4:
+			irq = cpu->reg[B];
+			bits = cpu->reg[C] ? std::min<unsigned>(cpu->reg[C], 48) : 48;
+			fired = elapsed() >> bits;
+			break;
+	}
+
+	reschedule();
+}
+
+void PerfCounter::wake()
+{
+	for(uint64_t n = elapsed() >> bits; fired < n; fired++)
+		cpu->interrupt(irq, true);
+
+	reschedule();
+}
@@ -0,0 +1,45 @@
+#include <climits>
+#include <vector>
+
+#include "recompiled.h"
+
+uint64_t Recompiled::run(DCPU16& cpu, uint64_t budget)
+{
+	// Block by address, made on first use
+	static const std::vector<Block> blocks = []()
+	{
+		std::vector<Block> table(0x10000, nullptr);
+		for(size_t i = 0; i < entryCount; i++)
+			table[entries[i].address] = entries[i].block;
+		return table;
+	}();
+
+	uint64_t executed = 0;
+	while(cpu.isRunning() && executed < budget)
+	{
+		cpu.service();
+
+		// Devices that tick see every instruction, so they leave nothing to blocks
+		Block block = blocks[cpu.reg[PC]];
+		if(block && cpu.tickers.empty())
+		{
+			uint64_t room = cpu.nextTimer - cpu.cycles();
+			Cost cost = block(cpu.reg, cpu, room < UINT_MAX ? (unsigned)room : UINT_MAX);
+
+			// Nothing: the first instruction is the interpreter's
+			if(cost.instructions)
+			{
+				cpu.tick(cost.cycles);
+				cpu.retired += cost.instructions;
+				executed += cost.instructions;
+				continue;
+			}
+		}
+
+		cpu.retired++;
+		cpu.execute();
+		executed++;
+	}
+
+	return executed;
+}
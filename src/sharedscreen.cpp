@@ -0,0 +1,106 @@
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "sharedscreen.h"
+
+SharedScreen* SharedScreen::create(const std::string& name)
+{
+	// A segment of that name is never rewritten in place: a viewer still reading it could take the reset
+	// header for a whole frame. It is unlinked instead, and its viewers keep the last frame they had.
+	shm_unlink(name.c_str());
+	int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+	if(fd < 0) return nullptr;
+
+	void* p = MAP_FAILED;
+	if(ftruncate(fd, sizeof(SharedScreenSegment)) == 0)
+		p = mmap(nullptr, sizeof(SharedScreenSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+	int error = errno;
+	close(fd);
+	if(p == MAP_FAILED) { errno = error; return nullptr; }
+
+	SharedScreen* screen = new SharedScreen();
+	screen->name = name;
+	screen->segment = new(p) SharedScreenSegment();
+
+	// Readers check the magic last: it goes in once everything else is in place
+	SharedScreenSegment& s = *screen->segment;
+	s.version = SharedScreenSegment::Version;
+	s.generation.store(0, std::memory_order_relaxed);
+	s.frame = s.cycle = 0;
+	memset(&s.state, 0, sizeof(s.state));
+	std::atomic_thread_fence(std::memory_order_release);
+	s.magic = SharedScreenSegment::Magic;
+
+	return screen;
+}
+
+SharedScreen::~SharedScreen()
+{
+	if(!segment) return;
+
+	munmap(segment, sizeof(SharedScreenSegment));
+	shm_unlink(name.c_str());
+}
+
+void SharedScreen::frame(const ScreenState& state, const uint8_t*, uint64_t number, uint64_t cycle)
+{
+	uint32_t g = segment->generation.load(std::memory_order_relaxed);
+	segment->generation.store(g + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	segment->frame = number;
+	segment->cycle = cycle;
+	segment->state = state;
+
+	segment->generation.store(g + 2, std::memory_order_release);
+}
+
+SharedScreenView* SharedScreenView::open(const std::string& name)
+{
+	int fd = shm_open(name.c_str(), O_RDONLY, 0);
+	if(fd < 0) return nullptr;
+
+	struct stat info;
+	void* p = MAP_FAILED;
+	if(fstat(fd, &info) == 0 && (size_t)info.st_size >= sizeof(SharedScreenSegment))
+		p = mmap(nullptr, sizeof(SharedScreenSegment), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(p == MAP_FAILED) return nullptr;
+
+	const SharedScreenSegment* segment = (const SharedScreenSegment*)p;
+	if(segment->magic != SharedScreenSegment::Magic || segment->version != SharedScreenSegment::Version)
+	{
+		munmap(p, sizeof(SharedScreenSegment));
+		return nullptr;
+	}
+
+	std::atomic_thread_fence(std::memory_order_acquire);
+
+	SharedScreenView* view = new SharedScreenView();
+	view->segment = segment;
+	return view;
+}
+
+SharedScreenView::~SharedScreenView()
+{
+	if(segment) munmap((void*)segment, sizeof(SharedScreenSegment));
+}
+
+bool SharedScreenView::read(ScreenState& state, uint64_t& frame, uint64_t& cycle) const
+{
+	uint32_t before = segment->generation.load(std::memory_order_acquire);
+	if(before == 0 || (before & 1)) return false;
+
+	frame = segment->frame;
+	cycle = segment->cycle;
+	state = segment->state;
+
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return segment->generation.load(std::memory_order_relaxed) == before;
+}
@@ -0,0 +1,61 @@
+#include <cstdlib>
+#include <cstring>
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_render.h>
+
+#include "window.h"
+#include "metrics.h"
+
+Window::Window(Metrics* metrics) : metrics(metrics)
+{
+	pixels.resize(SCREEN_WIDTH * SCREEN_HEIGHT * 4, 0);
+
+	SDL_Init(SDL_INIT_EVERYTHING);
+	atexit(SDL_Quit);
+
+	frameEvent = SDL_RegisterEvents(1);
+
+	window = SDL_CreateWindow("LEM1802", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, SCREEN_WIDTH * SCALE, SCREEN_HEIGHT * SCALE, SDL_WINDOW_SHOWN);
+	renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+	texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, SCREEN_WIDTH, SCREEN_HEIGHT);
+}
+
+Window::~Window()
+{
+	SDL_DestroyRenderer(renderer);
+	SDL_DestroyWindow(window);
+	SDL_Quit();
+}
+
+void Window::frame(const ScreenState&, const uint8_t* frame, uint64_t, uint64_t)
+{
+	{
+		std::lock_guard<std::mutex> guard(frameLock);
+		memcpy(pixels.data(), frame, pixels.size());
+	}
+
+	// One event in flight at most: a slow display skips frames instead of queueing them
+	if(!framePending.exchange(true))
+	{
+		SDL_Event event = {};
+		event.type = frameEvent;
+		SDL_PushEvent(&event);
+	}
+}
+
+void Window::present()
+{
+	Stopwatch present(metrics ? &metrics->lemPresent : nullptr);
+
+	framePending.store(false);
+
+	{
+		std::lock_guard<std::mutex> guard(frameLock);
+		SDL_UpdateTexture(texture, NULL, &pixels[0], SCREEN_WIDTH * 4);
+	}
+
+	SDL_RenderClear(renderer);
+	SDL_RenderCopy(renderer, texture, NULL, NULL);
+	SDL_RenderPresent(renderer);
+}
@@ -0,0 +1,312 @@
+// Ahead-of-time translator from assembled DCPU-16 programs to C++ (see recompiled.h)
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "dcpu16.h"
+#include "assembler.h"
+#include "disassembler.h"
+#include "common.h"
+
+// Semantics of the basic opcodes, written in terms of the operand references a and b
+static const char* const basic_ops[0x20] =
+{
+	nullptr,
+	"b = a;",
+	"uint32_t t = b + a; b = (uint16_t)t; R[EX] = (uint16_t)(t >> 16);",
+	"uint32_t t = b - a; b = (uint16_t)t; R[EX] = (uint16_t)(t >> 16);",
+	"uint32_t t = b * a; b = (uint16_t)t; R[EX] = (uint16_t)(t >> 16);",
+	"sint32 s = (sint16)b * (sint16)a; b = (uint16_t)s; R[EX] = (uint16_t)(s >> 16);",
+	"uint32_t t = a ? ((uint32_t)b << 16) / a : 0; b = (uint16_t)(t >> 16); R[EX] = (uint16_t)t;",
+	"sint32 s = (sint16)a ? ((sint32)(sint16)b << 16) / (sint16)a : 0; b = (uint16_t)(s >> 16); R[EX] = (uint16_t)s;",
+	"b = (uint16_t)(a ? b % a : 0);",
+	"b = (uint16_t)((sint16)a ? (sint32)(sint16)b % (sint16)a : 0);",
+	"b &= a;",
+	"b |= a;",
+	"b ^= a;",
+	"uint32_t t = ((uint32_t)b << 16) >> a; b = (uint16_t)(t >> 16); R[EX] = (uint16_t)t;",
+	"sint32 s = ((sint32)(sint16)b << 16) >> a; b = (uint16_t)(s >> 16); R[EX] = (uint16_t)s;",
+	"uint32_t t = (uint32_t)b << a; b = (uint16_t)t; R[EX] = (uint16_t)(t >> 16);",
+	"(b & a)", "!(b & a)", "(b == a)", "(b != a)", "(b > a)", "((sint16)b > (sint16)a)", "(b < a)", "((sint16)b < (sint16)a)",
+	nullptr, nullptr,
+	"uint32_t t = b + a + R[EX]; b = (uint16_t)t; R[EX] = (t >> 16) != 0 ? 0x0001 : 0x0000;",
+	"uint32_t t = b - a + R[EX]; b = (uint16_t)t; R[EX] = (uint16_t)(t >> 16);",
+	nullptr, nullptr,
+	"b = a; R[I]++; R[J]++;",
+	"b = a; R[I]--; R[J]--;"
+};
+
+static const unsigned MaxBlock = 64; // instructions
+
+struct Translator
+{
+	const uint16_t* mem;
+	const Disassembler& disasm;
+	std::set<uint16_t> leaders, done;
+	std::deque<uint16_t> work;
+	std::map<uint16_t, std::string> blocks;
+	std::map<uint16_t, std::vector<std::pair<uint32_t, uint32_t>>> covers; // code each block was translated from
+	std::set<uint16_t> written;                    // constant addresses stored to, e.g. SET [0x1234], A
+
+	Translator(const uint16_t* m, const Disassembler& d) : mem(m), disasm(d) {}
+
+	void seed(uint32_t addr)
+	{
+		if(addr < 0x10000 && leaders.insert((uint16_t)addr).second) work.push_back((uint16_t)addr);
+	}
+
+	static bool isIf(uint16_t inst)   { return (inst & 0x1F) >= INSTR::IFB && (inst & 0x1F) <= INSTR::IFU; }
+	static bool hasWord(unsigned v)   { return v < 0x20 && (reg_specs[v] & IMM); }
+	static bool isLiteral(unsigned v) { return v >= 0x20 || v == 0x1F; }
+
+	// Can the instruction at pc be translated, or must the interpreter run it?
+	static bool translatable(uint16_t inst)
+	{
+		unsigned op = inst & 0x1F, bb = (inst >> 5) & 0x1F;
+		if(op == INSTR::NBI) return bb == NBI::JSR || (bb == NBI::IAG && (inst >> 10) != 0x1C) || bb == NBI::IAS;
+		return basic_ops[op] != nullptr;
+	}
+
+	uint16_t literal(unsigned v, uint16_t pc) const { return v >= 0x20 ? (uint16_t)(v - 0x21) : mem[pc]; }
+
+	// Declares `name` as the operand, mirroring DCPU16::value<>: a reference if it is `written`, else
+	// memory operands are read into a copy
+	std::string operand(char name, unsigned v, uint16_t pc, bool writing) const
+	{
+		char buf[96];
+		if(v == 0x18)
+		{
+			const char* addr = name == 'a' ? "R[SP]++" : "--R[SP]";
+			if(writing || name == 'b') std::snprintf(buf, sizeof(buf), "uint16_t& %c = M.writable(%s);", name, addr);
+			else std::snprintf(buf, sizeof(buf), "uint16_t %c = M.read(%s);", name, addr);
+		}
+		else if(isLiteral(v)) std::snprintf(buf, sizeof(buf), "uint16_t l%c = 0x%04X; uint16_t& %c = l%c;", name, literal(v, pc), name, name);
+		else
+		{
+			const auto specs = reg_specs[v];
+			const unsigned r = specs & 0xFu;
+			char addr[48];
+
+			if(!(specs & IMM)) std::snprintf(addr, sizeof(addr), "R[%s]", regnames[r]);
+			else if(r == NOREG) std::snprintf(addr, sizeof(addr), "0x%04X", mem[pc]);
+			else std::snprintf(addr, sizeof(addr), "(uint16_t)(R[%s] + 0x%04X)", regnames[r], mem[pc]);
+
+			if(!(specs & MEM)) std::snprintf(buf, sizeof(buf), "uint16_t& %c = %s;", name, addr);
+			else if(writing) std::snprintf(buf, sizeof(buf), "uint16_t& %c = M.writable(%s);", name, addr);
+			else std::snprintf(buf, sizeof(buf), "uint16_t %c = M.read(%s);", name, addr);
+		}
+
+		return buf;
+	}
+
+	// Address and cycle cost of skipping the instruction(s) following a failed IF
+	void skip(uint16_t pc, uint16_t& target, unsigned& cycles) const
+	{
+		for(;;)
+		{
+			uint16_t inst = mem[pc];
+			unsigned n = Disassembler::length(inst);
+			cycles += n - 1;
+			pc = (uint16_t)(pc + n);
+
+			if(!isIf(inst)) break;
+			cycles += 1;
+		}
+
+		target = pc;
+	}
+
+	void translate(uint16_t start)
+	{
+		std::string code;
+		std::vector<char> text(disasm.maxText() + 1);
+		char line[256];
+		unsigned cycles = 0, count = 0;
+		uint32_t pc = start;
+		std::vector<std::pair<uint32_t, uint32_t>> cover;
+
+		auto leave = [&](uint32_t next, unsigned spent, unsigned executed)
+		{
+			std::snprintf(line, sizeof(line), "\tR[PC] = 0x%04X; return { %u, %u };\n", (unsigned)next & 0xFFFF, spent, executed);
+			return std::string(line);
+		};
+
+		for(;;)
+		{
+			uint16_t inst = mem[pc];
+			unsigned n = Disassembler::length(inst);
+
+			if(pc + n > 0x10000 || count == MaxBlock || !translatable(inst))
+			{
+				// Let the dispatcher (or the interpreter, for this instruction) take over from here
+				code += leave(pc, cycles, count);
+				seed(count == MaxBlock ? pc : pc + n);
+				if(count == 0) return;
+				break;
+			}
+
+			unsigned op = inst & 0x1F, bb = (inst >> 5) & 0x1F, aa = (inst >> 10) & 0x3F;
+			uint16_t apc = (uint16_t)(pc + 1), bpc = (uint16_t)(apc + hasWord(aa));
+			uint32_t next = pc + n;
+
+			cover.emplace_back(pc, next);
+			if(op != INSTR::NBI && !isIf(inst) && bb == 0x1E) written.insert(mem[bpc]);
+			if(op == INSTR::NBI && bb == NBI::IAG && aa == 0x1E) written.insert(mem[apc]);
+
+			text[disasm.instruction((uint16_t)pc, &text[0])] = '\0';
+			std::snprintf(line, sizeof(line), "\t// %04X: ", (unsigned)pc);
+			code += line + std::string(&text[0]) + "\n";
+
+			// The interpreter runs the instruction instead if its cycles (or a failed IF's, with the
+			// skipping) would reach a device, or if an interrupt must be taken first
+			unsigned cost = n - 1 + (op == INSTR::NBI ? special_cycles[bb] : basic_cycles[op]);
+			if(isIf(inst))
+			{
+				uint16_t target;
+				skip((uint16_t)next, target, cost);
+			}
+
+			std::snprintf(line, sizeof(line), "\tif(%u >= room || Recompiled::waiting(M)) { R[PC] = 0x%04X; return { %u, %u }; }\n\t{\n",
+				cycles + cost, (unsigned)pc, cycles, count);
+			code += line;
+
+			// Operands that read PC see the address of the next instruction
+			if(aa == 0x1C || (op != INSTR::NBI && bb == 0x1C) || (op == INSTR::NBI && bb == NBI::JSR))
+			{
+				std::snprintf(line, sizeof(line), "\t\tR[PC] = 0x%04X;\n", (unsigned)next & 0xFFFF);
+				code += line;
+			}
+
+			// a is written by IAG, and JSR reads it after pushing (see DCPU16::execute())
+			code += "\t\t" + operand('a', aa, apc, op == INSTR::NBI && (bb == NBI::JSR || bb == NBI::IAG)) + "\n";
+			if(op != INSTR::NBI) code += "\t\t" + operand('b', bb, bpc, !isIf(inst)) + "\n";
+
+			cycles += n - 1;
+			count++;
+
+			if(op == INSTR::NBI)
+			{
+				cycles += special_cycles[bb];
+
+				if(bb == NBI::JSR)
+				{
+					code += "\t\tM.writable(--R[SP]) = R[PC]; R[PC] = a;\n";
+					std::snprintf(line, sizeof(line), "\t\treturn { %u, %u };\n\t}\n", cycles, count);
+					code += line;
+
+					if(isLiteral(aa)) seed(literal(aa, apc));
+					seed(next);
+					break;
+				}
+
+				code += bb == NBI::IAG ? "\t\ta = R[IA];\n" : "\t\tR[IA] = a;\n";
+				if(bb == NBI::IAS && isLiteral(aa)) seed(literal(aa, apc));
+			}
+			else if(isIf(inst))
+			{
+				uint16_t target;
+				unsigned skipped = cycles + basic_cycles[op];
+				skip((uint16_t)next, target, skipped);
+
+				std::snprintf(line, sizeof(line), "\t\tif(!%s) { R[PC] = 0x%04X; return { %u, %u }; }\n", basic_ops[op], target, skipped, count);
+				code += line;
+				cycles += basic_cycles[op];
+				seed(target);
+			}
+			else
+			{
+				code += std::string("\t\t") + basic_ops[op] + "\n";
+				cycles += basic_cycles[op];
+
+				if(bb == 0x1C)
+				{
+					// Wrote PC: a jump
+					std::snprintf(line, sizeof(line), "\t\treturn { %u, %u };\n\t}\n", cycles, count);
+					code += line;
+
+					if(op == INSTR::SET && isLiteral(aa)) seed(literal(aa, apc));
+					break;
+				}
+			}
+
+			code += "\t}\n";
+			pc = next;
+		}
+
+		blocks[start] = code;
+		covers[start].swap(cover);
+	}
+
+	void run()
+	{
+		while(!work.empty())
+		{
+			uint16_t addr = work.front();
+			work.pop_front();
+			if(done.insert(addr).second) translate(addr);
+		}
+
+		// Code that is visibly patched at run time stays with the interpreter
+		for(auto it = blocks.begin(); it != blocks.end(); )
+		{
+			bool patched = false;
+			for(const auto& c : covers[it->first])
+			{
+				auto w = written.lower_bound((uint16_t)c.first);
+				patched |= w != written.end() && *w < c.second;
+			}
+
+			it = patched ? blocks.erase(it) : std::next(it);
+		}
+	}
+};
+
+int main(int argc, char* argv[])
+{
+	if(argc <= 2) return printf("Usage:\t./dcpu-aot <program file> <output.cpp>\n");
+
+	std::string buff;
+	if(!readFile(argv[1], buff)) { perror(argv[1]); return 1; }
+
+	Assembler as(buff);
+	auto symbols = as.labels();
+	std::vector<uint16_t> image = std::move(as);
+
+	Disassembler disasm(image.data(), symbols);
+	Translator tr(image.data(), disasm);
+
+	// Execution starts at 0; everything else is found by following static control flow
+	tr.seed(0);
+	tr.run();
+
+	FILE* out = fopen(argv[2], "wb");
+	if(!out) { perror(argv[2]); return 1; }
+
+	fprintf(out, "// Generated by dcpu-aot from %s. Do not edit.\n#include \"recompiled.h\"\n\n", argv[1]);
+	fprintf(out, "const char Recompiled::source[] = \"%s\";\n\n", argv[1]);
+
+	size_t size = image.size();
+	while(size > 0 && image[size - 1] == 0) size--;
+
+	fprintf(out, "const size_t Recompiled::imageSize = %zu;\nconst uint16_t Recompiled::image[] =\n{", size);
+	for(size_t i = 0; i < std::max<size_t>(size, 1); i++)
+		fprintf(out, "%s0x%04X,", i % 16 ? " " : "\n\t", i < size ? image[i] : 0);
+	fprintf(out, "\n};\n\n");
+
+	for(const auto& b : tr.blocks)
+		fprintf(out, "static Recompiled::Cost bb_%04X(uint16_t* R, DCPU16& M, unsigned room)\n{\n%s}\n\n", b.first, b.second.c_str());
+
+	fprintf(out, "const size_t Recompiled::entryCount = %zu;\nconst Recompiled::Entry Recompiled::entries[] =\n{\n", tr.blocks.size());
+	for(const auto& b : tr.blocks)
+		fprintf(out, "\t{ 0x%04X, bb_%04X },\n", b.first, b.first);
+	fprintf(out, "};\n");
+
+	fclose(out);
+	fprintf(stderr, "%zu blocks translated from %s\n", tr.blocks.size(), argv[1]);
+
+	return 0;
+}
@@ -0,0 +1,58 @@
+// Runner for a program translated by dcpu-aot (linked together with the generated code)
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "dcpu16.h"
+#include "recompiled.h"
+#include "clock.h"
+#include "perfcounter.h"
+
+#ifdef DCPU_WITH_SDL
+#include "lem1802.h"
+#include "window.h"
+#include "keyboard.h"
+#include "events.h"
+#endif
+
+int main(int argc, char* argv[])
+{
+	uint64_t budget = UINT64_MAX;
+	uint16_t delay = 0;
+
+	for(int i = 1; i + 1 < argc; i += 2)
+	{
+		if(!strcmp(argv[i], "-n")) budget = strtoull(argv[i + 1], nullptr, 0);
+		else if(!strcmp(argv[i], "-d")) delay = (uint16_t)atoi(argv[i + 1]);
+		else return printf("Usage:\t%s [-d <delay>] [-n <instructions>]\n", argv[0]);
+	}
+
+	DCPU16* cpu = new DCPU16(std::vector<uint16_t>(Recompiled::image, Recompiled::image + Recompiled::imageSize));
+	uint64_t executed = 0;
+#ifdef DCPU_WITH_SDL
+	LEM1802* screen = new LEM1802(cpu, delay);
+	Keyboard* keyboard = new Keyboard(cpu);
+	Window window;
+	screen->attach(&window);
+	cpu->installHardware(screen);
+	cpu->installHardware(keyboard);
+	cpu->installHardware(new Clock(cpu));
+	cpu->installHardware(new PerfCounter(cpu));
+
+	runInteractive(*cpu, &window, keyboard, [&]() { executed = Recompiled::run(*cpu, budget); });
+#else
+	(void)delay;
+	cpu->installHardware(new Clock(cpu));
+	cpu->installHardware(new PerfCounter(cpu));
+	executed = Recompiled::run(*cpu, budget);
+#endif
+
+	fprintf(stderr, "%s: %llu instructions, %llu cycles\n", Recompiled::source, (unsigned long long)executed, (unsigned long long)cpu->cycles());
+	for(unsigned r = 0; r < 12; r++)
+		fprintf(stderr, "%s=%04X%c", regnames[r], cpu->registers()[r], r == 11 ? '\n' : ' ');
+
+	delete cpu;
+
+	return 0;
+}
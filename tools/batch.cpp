@@ -0,0 +1,186 @@
+// Batch assembler and regression runner for DCPU-16 programs
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "dcpu16.h"
+#include "assembler.h"
+#include "common.h"
+
+struct Job
+{
+	std::string source, golden;
+
+	// Results
+	std::string state;
+	uint64_t instructions = 0, cycles = 0;
+	bool halted = false, readable = true;
+	double assembleMs = 0.0, runMs = 0.0;
+	enum { PASS, FAIL, NEW, MISSING, ERROR } status = ERROR;
+};
+
+static uint64_t hashMemory(const DCPU16& cpu)
+{
+	// FNV-1a over the little-endian byte image of the whole 64K words
+	uint64_t h = 0xcbf29ce484222325ull;
+	for(unsigned i = 0; i < 0x10000; i++)
+	{
+		uint16_t w = cpu.read((uint16_t)i);
+		h = (h ^ (w & 0xFF)) * 0x100000001b3ull;
+		h = (h ^ (w >>  8)) * 0x100000001b3ull;
+	}
+
+	return h;
+}
+
+static std::string describe(const DCPU16& cpu, uint64_t budget)
+{
+	std::string s;
+	char line[80];
+
+	// The budget goes first: goldens made with a different one are different runs
+	std::snprintf(line, sizeof(line), "BUDGET=%llu\n", (unsigned long long)budget);
+	s += line;
+
+	for(unsigned r = 0; r < 12; r++)
+	{
+		std::snprintf(line, sizeof(line), "%s=%04X\n", regnames[r], cpu.registers()[r]);
+		s += line;
+	}
+
+	std::snprintf(line, sizeof(line), "CYCLES=%llu\n", (unsigned long long)cpu.cycles());
+	s += line;
+	std::snprintf(line, sizeof(line), "MEM=%016llX\n", (unsigned long long)hashMemory(cpu));
+	return s += line;
+}
+
+static void run(Job& job, uint64_t budget, bool update)
+{
+	typedef std::chrono::steady_clock clock;
+
+	std::string source, golden;
+	if(!readFile(job.source, source)) { job.readable = false; return; }
+
+	auto t0 = clock::now();
+	std::vector<uint16_t> image = Assembler(source);
+	auto t1 = clock::now();
+
+	// No hardware is installed: the run must be deterministic and must not need a window.
+	DCPU16 cpu(image);
+	while(cpu.isRunning() && cpu.cycles() < budget)
+	{
+		uint16_t pc = cpu.registers()[PC];
+		unsigned n = cpu.step(budget);
+		job.instructions += n;
+
+		// A jump to itself ("SUB PC, 1" or ":l SET PC, l") is the customary way to stop; step() never
+		// fuses one, so a pair that ends where it started is a loop
+		if(n == 1 && cpu.registers()[PC] == pc) { job.halted = true; break; }
+	}
+	auto t2 = clock::now();
+
+	job.assembleMs = std::chrono::duration<double, std::milli>(t1 - t0).count();
+	job.runMs      = std::chrono::duration<double, std::milli>(t2 - t1).count();
+	job.cycles     = cpu.cycles();
+	job.state      = describe(cpu, budget);
+
+	// Goldens are only written when asked to: a missing one fails, so a wrong -g cannot pass
+	bool found = readFile(job.golden, golden);
+	if(!update)
+	{
+		job.status = !found ? Job::MISSING : golden == job.state ? Job::PASS : Job::FAIL;
+		return;
+	}
+
+	if(found && golden == job.state) { job.status = Job::PASS; return; }
+
+	FILE* file = fopen(job.golden.c_str(), "wb");
+	if(!file) return;
+
+	fwrite(job.state.data(), 1, job.state.size(), file);
+	fclose(file);
+	job.status = Job::NEW;
+}
+
+int main(int argc, char* argv[])
+{
+	unsigned threads = std::thread::hardware_concurrency();
+	uint64_t budget = 20000000; // cycles
+	std::string goldenDir;
+	bool update = false;
+	std::vector<Job> jobs;
+
+	for(int i = 1; i < argc; i++)
+	{
+		if(!strcmp(argv[i], "-j") && i + 1 < argc) threads = (unsigned)atoi(argv[++i]);
+		else if(!strcmp(argv[i], "-c") && i + 1 < argc) budget = strtoull(argv[++i], nullptr, 0);
+		else if(!strcmp(argv[i], "-g") && i + 1 < argc) goldenDir = argv[++i];
+		else if(!strcmp(argv[i], "-u")) update = true;
+		else
+		{
+			Job job;
+			job.source = argv[i];
+
+			// <dir>/prog.dasm -> <golden dir>/prog.golden (or next to the source)
+			std::string base = job.source.substr(0, job.source.find_last_of('.'));
+			if(!goldenDir.empty()) base = goldenDir + "/" + base.substr(base.find_last_of("/\\") + 1);
+			job.golden = base + ".golden";
+
+			jobs.push_back(job);
+		}
+	}
+
+	if(jobs.empty())
+		return printf("Usage:\t./dcpu-batch [-j <threads>] [-c <cycles>] [-g <golden dir>] [-u] <program file>...\n");
+
+	if(threads == 0) threads = 1;
+	if(threads > jobs.size()) threads = (unsigned)jobs.size();
+
+	auto start = std::chrono::steady_clock::now();
+
+	std::atomic<size_t> next(0);
+	std::vector<std::thread> pool;
+	for(unsigned t = 0; t < threads; t++)
+		pool.emplace_back([&]()
+		{
+			for(size_t i; (i = next++) < jobs.size(); )
+				run(jobs[i], budget, update);
+		});
+
+	for(auto& t : pool)
+		t.join();
+
+	double wall = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	static const char* status[] = { "PASS", "FAIL", "NEW", "MISS", "ERROR" };
+	unsigned failed = 0;
+
+	for(const auto& job : jobs)
+	{
+		if(job.status == Job::FAIL || job.status == Job::MISSING || job.status == Job::ERROR) failed++;
+
+		if(!job.readable)
+		{
+			printf("%-5s %-32s cannot read source\n", status[job.status], job.source.c_str());
+			continue;
+		}
+
+		if(job.status == Job::MISSING)
+		{
+			printf("%-5s %-32s no golden %s (-u writes it)\n", status[job.status], job.source.c_str(), job.golden.c_str());
+			continue;
+		}
+
+		printf("%-5s %-32s %-7s %12llu instr %12llu cycles  asm %8.2f ms  run %8.2f ms\n", status[job.status], job.source.c_str(),
+			job.halted ? "halted" : "budget", (unsigned long long)job.instructions, (unsigned long long)job.cycles, job.assembleMs, job.runMs);
+	}
+
+	printf("%u programs, %u failed, %u threads, %.2f ms wall\n", (unsigned)jobs.size(), failed, threads, wall);
+
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,383 @@
+// Emulator benchmarks: per-opcode and per-addressing-mode kernels, and whole programs run headless
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "dcpu16.h"
+#include "assembler.h"
+#include "common.h"
+
+#ifndef DCPU_PROGRAMS_DIR
+#define DCPU_PROGRAMS_DIR "programs"
+#endif
+
+// Host cache misses of the calling thread, where the kernel lets us count them
+class CacheMisses
+{
+	int fd = -1;
+
+public:
+	CacheMisses()
+	{
+#ifdef __linux__
+		perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.size = sizeof(attr);
+		attr.config = PERF_COUNT_HW_CACHE_MISSES;
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		fd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+	}
+
+	~CacheMisses()
+	{
+#ifdef __linux__
+		if(fd >= 0) close(fd);
+#endif
+	}
+
+	bool available() const { return fd >= 0; }
+
+	void start()
+	{
+#ifdef __linux__
+		if(fd < 0) return;
+		ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+		ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+	}
+
+	long long stop()
+	{
+		long long count = -1;
+#ifdef __linux__
+		if(fd < 0) return count;
+		ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+		if(read(fd, &count, sizeof(count)) != sizeof(count)) count = -1;
+#endif
+		return count;
+	}
+};
+
+struct Result
+{
+	std::string name, kind;
+	uint64_t instructions = 0, cycles = 0, fused = 0;
+	double seconds = 0.0, unfusedSeconds = -1.0;
+	long long cacheMisses = -1;
+};
+
+// One instruction repeated through a micro-benchmark loop
+struct Kernel
+{
+	std::string name, kind;
+	unsigned op, b, a;
+	uint16_t nextA, nextB;
+	enum { PLAIN, PAIRED, CHAIN, TRAP } shape;
+};
+
+static const uint16_t Data = 0x8000; // registers, SP and pointer operands all land here
+static const unsigned Repeat = 256;  // copies of the kernel per loop iteration
+
+static void emit(std::vector<uint16_t>& m, unsigned op, unsigned b, unsigned a, uint16_t nextA = 0, uint16_t nextB = 0)
+{
+	m.push_back((uint16_t)(op | b << 5 | a << 10));
+	if(operand_cycles(a)) m.push_back(nextA);
+	if(op && operand_cycles(b)) m.push_back(nextB);
+}
+
+// setup: SET <all registers>, Data; IAS handler
+// loop:  SET SP, Data; <kernel> x Repeat; SET PC, loop
+// handler: RFI 0
+static std::vector<uint16_t> build(const Kernel& k)
+{
+	std::vector<uint16_t> m;
+	for(unsigned r = A; r <= J; r++) emit(m, INSTR::SET, r, 0x1F, Data);
+
+	size_t ias = m.size();
+	if(k.shape == Kernel::TRAP) emit(m, INSTR::NBI, NBI::IAS, 0x1F);
+
+	uint16_t loop = (uint16_t)m.size();
+	emit(m, INSTR::SET, 0x1B, 0x1F, Data);
+
+	for(unsigned i = 0; i < Repeat; i++)
+	{
+		if(k.shape == Kernel::CHAIN)
+		{
+			// JSR to the very next instruction
+			emit(m, k.op, k.b, k.a, (uint16_t)(m.size() + 2));
+			continue;
+		}
+
+		emit(m, k.op, k.b, k.a, k.nextA, k.nextB);
+		if(k.shape == Kernel::PAIRED) emit(m, INSTR::SET, X, X); // what a failed IF skips
+	}
+
+	emit(m, INSTR::SET, 0x1C, 0x1F, loop);
+
+	if(k.shape == Kernel::TRAP)
+	{
+		m[ias + 1] = (uint16_t)m.size();
+		emit(m, INSTR::NBI, NBI::RFI, 0x21);
+	}
+
+	m.resize(0x10000);
+	return m;
+}
+
+static std::vector<Kernel> kernels()
+{
+	std::vector<Kernel> ks;
+
+	for(unsigned op = INSTR::SET; op < 0x20; op++)
+	{
+		std::string name(&ins_set[3 * (32 + op)], 3);
+		if(name == "...") continue;
+
+		bool isIf = op >= INSTR::IFB && op <= INSTR::IFU;
+		ks.push_back({ isIf ? name + "+SET" : name, "opcode", op, A, B, 0, 0, isIf ? Kernel::PAIRED : Kernel::PLAIN });
+	}
+
+	// Special opcodes, with operands that keep control flow inside the loop
+	ks.push_back({ "JSR",       "opcode", INSTR::NBI, NBI::JSR, 0x1F, 0, 0, Kernel::CHAIN });
+	ks.push_back({ "INT",       "opcode", INSTR::NBI, NBI::INT, 0x21, 0, 0, Kernel::PLAIN }); // IA = 0: ignored
+	ks.push_back({ "INT+RFI",   "opcode", INSTR::NBI, NBI::INT, 0x21, 0, 0, Kernel::TRAP });
+	ks.push_back({ "IAG",       "opcode", INSTR::NBI, NBI::IAG, A,    0, 0, Kernel::PLAIN });
+	ks.push_back({ "IAS",       "opcode", INSTR::NBI, NBI::IAS, 0x21, 0, 0, Kernel::PLAIN });
+	ks.push_back({ "IAQ",       "opcode", INSTR::NBI, NBI::IAQ, 0x21, 0, 0, Kernel::PLAIN });
+	ks.push_back({ "HWN",       "opcode", INSTR::NBI, NBI::HWN, A,    0, 0, Kernel::PLAIN });
+	ks.push_back({ "HWQ",       "opcode", INSTR::NBI, NBI::HWQ, 0x21, 0, 0, Kernel::PLAIN });
+	ks.push_back({ "HWI",       "opcode", INSTR::NBI, NBI::HWI, 0x21, 0, 0, Kernel::PLAIN });
+
+	// Every kind of operand DCPU16::value resolves, as a source (SET A, a) and as a destination (SET b, B)
+	static const struct { const char* name; unsigned v; uint16_t next; } modes[] =
+	{
+		{ "reg", 0x01, 0 }, { "[reg]", 0x09, 0 }, { "[reg+next]", 0x11, 0x10 }, { "PUSH/POP", 0x18, 0 },
+		{ "PEEK", 0x19, 0 }, { "PICK", 0x1A, 1 }, { "SP", 0x1B, 0 }, { "PC", 0x1C, 0 }, { "EX", 0x1D, 0 },
+		{ "[next]", 0x1E, 0x9000 }, { "next", 0x1F, 0x1234 }, { "literal", 0x22, 0 },
+	};
+
+	for(const auto& m : modes)
+		ks.push_back({ std::string("a=") + m.name, "operand", INSTR::SET, A, m.v, m.next, 0, Kernel::PLAIN });
+
+	for(const auto& m : modes)
+	{
+		if(m.v == 0x1C || m.v >= 0x20) continue; // writing PC would leave the loop; literals are not destinations
+		ks.push_back({ std::string("b=") + m.name, "operand", INSTR::SET, m.v == 0x01 ? (unsigned)A : m.v, B, 0, m.next, Kernel::PLAIN });
+	}
+
+	return ks;
+}
+
+// Fastest of `repeat` headless runs of `budget` cycles
+// With `fuse`, common instruction pairs run in one dispatch (see DCPU16::step())
+static Result measure(const std::vector<uint16_t>& image, uint64_t budget, unsigned repeat, CacheMisses& perf, bool fuse)
+{
+	typedef std::chrono::steady_clock clock;
+	Result best;
+
+	for(unsigned r = 0; r < repeat; r++)
+	{
+		DCPU16 cpu(image);
+		uint64_t n = 0;
+
+		perf.start();
+		auto t0 = clock::now();
+		while(cpu.cycles() < budget)
+			n += cpu.step(fuse ? budget : 0);
+		auto t1 = clock::now();
+		long long misses = perf.stop();
+
+		double s = std::chrono::duration<double>(t1 - t0).count();
+		if(r == 0 || s < best.seconds)
+		{
+			best.instructions = n;
+			best.cycles = cpu.cycles();
+			best.fused = cpu.fused();
+			best.seconds = s;
+			best.cacheMisses = misses;
+		}
+	}
+
+	return best;
+}
+
+// Mnemonic and operand kinds, e.g. "IFE reg, n": what fused pairs are made of
+static std::string shape(uint16_t inst)
+{
+	auto kind = [](unsigned v, bool isA) -> std::string
+	{
+		static const char* const names[] = { "reg", "[reg]", "[reg+n]", "PUSH", "PEEK", "PICK", "SP", "PC", "EX", "[n]" };
+		if(v < 0x18) return names[v / 8];
+		if(v == 0x18) return isA ? "POP" : "PUSH";
+		return v <= 0x1E ? names[v - 0x18 + 3] : "n";
+	};
+
+	unsigned op = inst & 0x1F, b = (inst >> 5) & 0x1F, a = inst >> 10;
+	if(op == INSTR::NBI) return std::string(&ins_set[b * 3], 3) + " " + kind(a, true);
+	return std::string(&ins_set[(32 + op) * 3], 3) + " " + kind(b, false) + ", " + kind(a, true);
+}
+
+// Dynamic instruction pairs over the programs, most frequent first, marking those step() fuses
+static void profilePairs(const std::vector<std::pair<std::string, std::vector<uint16_t>>>& programs, uint64_t budget, unsigned top)
+{
+	struct Pair { uint64_t count = 0; uint16_t first = 0, second = 0; };
+	std::map<std::string, Pair> pairs;
+	uint64_t total = 0;
+
+	for(const auto& program : programs)
+	{
+		DCPU16 cpu(program.second);
+		uint16_t previous = 0;
+		bool first = true;
+
+		for(; cpu.isRunning() && cpu.cycles() < budget; total++)
+		{
+			uint16_t inst = cpu.read(cpu.registers()[PC]);
+			if(!first)
+			{
+				Pair& p = pairs[shape(previous) + " ; " + shape(inst)];
+				p.count++;
+				p.first = previous;
+				p.second = inst;
+			}
+
+			cpu.step();
+			previous = inst;
+			first = false;
+		}
+	}
+
+	std::vector<std::pair<uint64_t, std::string>> order;
+	for(const auto& p : pairs)
+		order.emplace_back(p.second.count, p.first);
+	std::sort(order.rbegin(), order.rend());
+
+	printf("%llu instructions in %zu programs; * fused\n", (unsigned long long)total, programs.size());
+	for(size_t i = 0; i < order.size() && i < top; i++)
+	{
+		const Pair& p = pairs[order[i].second];
+		printf("%6.2f%% %c %s\n", 100.0 * (double)p.count / (double)total, DCPU16::fuses(p.first, p.second) ? '*' : ' ', order[i].second.c_str());
+	}
+}
+
+static void report(FILE* out, const std::vector<Result>& results)
+{
+	for(size_t i = 0; i < results.size(); i++)
+	{
+		const Result& r = results[i];
+		fprintf(out, "\t\t{ \"name\": \"%s\", \"kind\": \"%s\", \"instructions\": %llu, \"cycles\": %llu, \"seconds\": %.6f, "
+			"\"emulated_mhz\": %.3f, \"ns_per_instruction\": %.3f, \"cache_misses\": ",
+			r.name.c_str(), r.kind.c_str(), (unsigned long long)r.instructions, (unsigned long long)r.cycles, r.seconds,
+			(double)r.cycles / r.seconds / 1e6, r.seconds * 1e9 / (double)r.instructions);
+		if(r.cacheMisses < 0) fprintf(out, "null, ");
+		else fprintf(out, "%lld, ", r.cacheMisses);
+		fprintf(out, "\"fused_pairs\": %llu, \"unfused_seconds\": ", (unsigned long long)r.fused);
+		if(r.unfusedSeconds < 0.0) fprintf(out, "null }");
+		else fprintf(out, "%.6f }", r.unfusedSeconds);
+		fprintf(out, "%s\n", i + 1 < results.size() ? "," : "");
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	uint64_t microBudget = 2000000, macroBudget = 20000000;
+	unsigned repeat = 3, top = 0;
+	std::string dir = DCPU_PROGRAMS_DIR, filter;
+	const char* output = nullptr;
+	std::vector<std::string> programs;
+
+	for(int i = 1; i < argc; i++)
+	{
+		if(!strcmp(argv[i], "-m") && i + 1 < argc) microBudget = strtoull(argv[++i], nullptr, 0);
+		else if(!strcmp(argv[i], "-c") && i + 1 < argc) macroBudget = strtoull(argv[++i], nullptr, 0);
+		else if(!strcmp(argv[i], "-r") && i + 1 < argc) repeat = (unsigned)atoi(argv[++i]);
+		else if(!strcmp(argv[i], "-f") && i + 1 < argc) filter = argv[++i];
+		else if(!strcmp(argv[i], "-p") && i + 1 < argc) dir = argv[++i];
+		else if(!strcmp(argv[i], "-o") && i + 1 < argc) output = argv[++i];
+		else if(!strcmp(argv[i], "-P") && i + 1 < argc) top = (unsigned)atoi(argv[++i]);
+		else if(argv[i][0] != '-') programs.push_back(argv[i]);
+		else
+			return printf("Usage:\t./dcpu-bench [-m <micro cycles>] [-c <program cycles>] [-r <repeat>] [-f <name filter>] "
+				"[-p <programs dir>] [-o <results.json>] [-P <pairs>] [program file...]\n"
+				"\t-P: instead of timing, list the most frequent instruction pairs in the programs\n");
+	}
+
+	if(repeat == 0) repeat = 1;
+
+	if(programs.empty())
+		for(const char* name : { "life", "matrix", "nyan", "test-v1", "test-v2", "test-v3", "test-v4", "test-v5" })
+			programs.push_back(dir + "/" + name + ".dasm");
+
+	auto selected = [&](const std::string& name) { return filter.empty() || name.find(filter) != std::string::npos; };
+
+	std::vector<std::pair<std::string, std::vector<uint16_t>>> images;
+	for(const std::string& path : programs)
+	{
+		std::string name = path.substr(path.find_last_of("/\\") + 1);
+		name = name.substr(0, name.find_last_of('.'));
+		if(!selected(name)) continue;
+
+		std::string source;
+		if(!readFile(path, source)) { perror(path.c_str()); return 1; }
+		images.emplace_back(name, isImage(path) ? loadImage(source) : std::vector<uint16_t>(Assembler(source)));
+	}
+
+	if(top) { profilePairs(images, macroBudget, top); return 0; }
+
+	CacheMisses perf;
+	std::vector<Result> micro, macro;
+
+	// Kernels time one instruction each, so they run unfused
+	for(const Kernel& k : kernels())
+	{
+		if(!selected(k.name)) continue;
+
+		Result r = measure(build(k), microBudget, repeat, perf, false);
+		r.name = k.name;
+		r.kind = k.kind;
+		micro.push_back(r);
+		fprintf(stderr, "%-16s %8.2f MHz %7.2f ns/instr\n", r.name.c_str(), (double)r.cycles / r.seconds / 1e6, r.seconds * 1e9 / (double)r.instructions);
+	}
+
+	// Programs run both ways, to show what fusing pairs saves
+	for(const auto& image : images)
+	{
+		Result r = measure(image.second, macroBudget, repeat, perf, true);
+		r.unfusedSeconds = measure(image.second, macroBudget, repeat, perf, false).seconds;
+		r.name = image.first;
+		r.kind = "program";
+		macro.push_back(r);
+		fprintf(stderr, "%-16s %8.2f MHz %7.2f ns/instr (%.2f unfused), %4.1f%% of dispatches saved\n", r.name.c_str(), (double)r.cycles / r.seconds / 1e6,
+			r.seconds * 1e9 / (double)r.instructions, r.unfusedSeconds * 1e9 / (double)r.instructions, 100.0 * (double)r.fused / (double)r.instructions);
+	}
+
+	FILE* out = output ? fopen(output, "wb") : stdout;
+	if(!out) { perror(output); return 1; }
+
+	fprintf(out, "{\n\t\"micro_cycles\": %llu,\n\t\"program_cycles\": %llu,\n\t\"repeat\": %u,\n\t\"perf_counters\": %s,\n",
+		(unsigned long long)microBudget, (unsigned long long)macroBudget, repeat, perf.available() ? "true" : "false");
+	fprintf(out, "\t\"micro\": [\n");
+	report(out, micro);
+	fprintf(out, "\t],\n\t\"macro\": [\n");
+	report(out, macro);
+	fprintf(out, "\t]\n}\n");
+
+	if(output) fclose(out);
+	return 0;
+}
@@ -0,0 +1,82 @@
+// Runs a program headless with a LEM1802 and records its screen: video, frame images and/or frame hashes
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "dcpu16.h"
+#include "assembler.h"
+#include "capture.h"
+#include "clock.h"
+#include "lem1802.h"
+#include "perfcounter.h"
+#include "sharedscreen.h"
+#include "common.h"
+
+int main(int argc, char* argv[])
+{
+	uint64_t budget = 6000000; // a minute of guest time
+	uint16_t delay = 0;
+	std::string program, format, exportName;
+	Capture::Options options;
+
+	for(int i = 1; i < argc; i++)
+	{
+		if(!strcmp(argv[i], "-c") && i + 1 < argc) budget = strtoull(argv[++i], nullptr, 0);
+		else if(!strcmp(argv[i], "-d") && i + 1 < argc) delay = (uint16_t)atoi(argv[++i]);
+		else if(!strcmp(argv[i], "-f") && i + 1 < argc) format = argv[++i];
+		else if(!strcmp(argv[i], "-o") && i + 1 < argc) options.path = argv[++i];
+		else if(!strcmp(argv[i], "-l") && i + 1 < argc) options.hashLog = argv[++i];
+		else if(!strcmp(argv[i], "-q") && i + 1 < argc) options.slots = strtoull(argv[++i], nullptr, 0);
+		else if(!strcmp(argv[i], "-x") && i + 1 < argc) exportName = argv[++i];
+		else if(!strcmp(argv[i], "-u")) options.dedup = true;
+		else if(!strcmp(argv[i], "-s")) options.lossless = true;
+		else program = argv[i];
+	}
+
+	options.format = Capture::parseFormat(format);
+
+	if(program.empty() || (!format.empty() && options.format == Capture::NONE) || (options.format != Capture::NONE && options.path.empty()) || options.slots == 0)
+		return printf("Usage:\t./dcpu-capture [-c <cycles>] [-d <frame delay ms>] [-f raw|y4m|png -o <output>] [-l <hash log>] [-u] [-s] [-q <slots>] [-x <shm name>] <program file>\n"
+			"\t-o: the video file, or for png the path every frame's number and .png are appended to\n"
+			"\t-u: write each run of identical frames once (the hash log still lists them all)\n"
+			"\t-s: never drop frames; the CPU waits for the encoder instead (for tests)\n"
+			"\t-q: frames the encoder may fall behind by before they are dropped\n"
+			"\t-x: publish the screen in a shared-memory segment for dcpu-viewer (e.g. /dcpu); use -d to pace it\n");
+
+	std::string source;
+	if(!readFile(program, source)) { perror(program.c_str()); return 1; }
+	std::vector<uint16_t> image = isImage(program) ? loadImage(source) : std::vector<uint16_t>(Assembler(source));
+
+	Capture capture(options);
+	if(!capture.ok()) { perror("capture"); return 1; }
+
+	std::unique_ptr<SharedScreen> shared(exportName.empty() ? nullptr : SharedScreen::create(exportName));
+	if(!exportName.empty() && !shared) { perror(exportName.c_str()); return 1; }
+
+	DCPU16 cpu(image);
+	LEM1802* screen = new LEM1802(&cpu, delay);
+	if(options.format != Capture::NONE || !options.hashLog.empty()) screen->attach(&capture);
+	if(shared) screen->attach(shared.get());
+	cpu.installHardware(screen);
+	cpu.installHardware(new Clock(&cpu));
+	cpu.installHardware(new PerfCounter(&cpu));
+
+	auto start = std::chrono::steady_clock::now();
+	while(cpu.isRunning() && cpu.cycles() < budget)
+		cpu.step(budget);
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	capture.close();
+
+	printf("%llu cycles in %.2f ms: %llu frames, %llu written, %llu repeated, %llu dropped\n", (unsigned long long)cpu.cycles(), ms,
+		(unsigned long long)capture.framesReceived(), (unsigned long long)capture.framesWritten(),
+		(unsigned long long)capture.framesRepeated(), (unsigned long long)capture.framesDropped());
+
+	if(!capture.ok()) { fprintf(stderr, "capture: write failed\n"); return 1; }
+
+	return 0;
+}
@@ -0,0 +1,161 @@
+// Runs several DCPU-16s, one host thread each, linked by Mailbox devices
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "dcpu16.h"
+#include "assembler.h"
+#include "clock.h"
+#include "m35fd.h"
+#include "mailbox.h"
+#include "perfcounter.h"
+#include "common.h"
+
+#ifndef DCPU_PROGRAMS_DIR
+#define DCPU_PROGRAMS_DIR "programs"
+#endif
+
+struct Node
+{
+	std::unique_ptr<DCPU16> cpu;
+	Mailbox* mailbox;
+};
+
+// Port numbering, as seen by the guest:
+//  ring: port 0 goes to the next node, port 1 to the previous one
+//  mesh: port k goes to node k (a node's own port is left unconnected)
+//  star: the hub (node 0) reaches node k through port k - 1; every other node has port 0 to the hub
+static void wire(std::vector<Node>& nodes, const std::string& topology, size_t capacity)
+{
+	unsigned n = (unsigned)nodes.size();
+
+	if(topology == "ring")
+		for(unsigned i = 0; i < n; i++)
+			Mailbox::connect(*nodes[i].mailbox, 0, *nodes[(i + 1) % n].mailbox, 1, capacity);
+	else if(topology == "mesh")
+		for(unsigned i = 0; i < n; i++)
+			for(unsigned j = i + 1; j < n; j++)
+				Mailbox::connect(*nodes[i].mailbox, j, *nodes[j].mailbox, i, capacity);
+	else if(topology == "star")
+		for(unsigned i = 1; i < n; i++)
+			Mailbox::connect(*nodes[0].mailbox, i - 1, *nodes[i].mailbox, 0, capacity);
+}
+
+struct Totals
+{
+	double ms;
+	uint64_t cycles, sent, received;
+};
+
+static Totals run(const std::vector<uint16_t>& image, const std::shared_ptr<DiskImage>& disk, unsigned count, const std::string& topology, size_t capacity, uint64_t budget, bool verbose)
+{
+	std::vector<Node> nodes(count);
+	for(unsigned i = 0; i < count; i++)
+	{
+		nodes[i].cpu.reset(new DCPU16(image));
+		nodes[i].mailbox = new Mailbox(nodes[i].cpu.get(), (uint16_t)i);
+		nodes[i].cpu->installHardware(nodes[i].mailbox);
+		nodes[i].cpu->installHardware(new Clock(nodes[i].cpu.get()));
+		nodes[i].cpu->installHardware(new PerfCounter(nodes[i].cpu.get()));
+		if(disk) nodes[i].cpu->installHardware(new M35FD(nodes[i].cpu.get(), disk));
+	}
+
+	wire(nodes, topology, capacity);
+
+	auto start = std::chrono::steady_clock::now();
+
+	std::vector<std::thread> threads;
+	for(auto& node : nodes)
+		threads.emplace_back([&node, budget]()
+		{
+			DCPU16& cpu = *node.cpu;
+			while(cpu.isRunning() && cpu.cycles() < budget)
+				cpu.step(budget);
+		});
+
+	for(auto& t : threads)
+		t.join();
+
+	Totals total = { std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count(), 0, 0, 0 };
+
+	for(unsigned i = 0; i < count; i++)
+	{
+		const Node& node = nodes[i];
+		total.cycles += node.cpu->cycles();
+		total.sent += node.mailbox->messagesSent();
+		total.received += node.mailbox->messagesReceived();
+
+		if(verbose)
+			printf("node %3u: %12llu cycles %10llu sent %10llu received\n", i, (unsigned long long)node.cpu->cycles(),
+				(unsigned long long)node.mailbox->messagesSent(), (unsigned long long)node.mailbox->messagesReceived());
+	}
+
+	return total;
+}
+
+int main(int argc, char* argv[])
+{
+	unsigned count = 4;
+	uint64_t budget = 10000000;
+	size_t capacity = 64;
+	std::string topology = "ring", program, floppy;
+	bool scaling = false;
+
+	for(int i = 1; i < argc; i++)
+	{
+		if(!strcmp(argv[i], "-n") && i + 1 < argc) count = (unsigned)atoi(argv[++i]);
+		else if(!strcmp(argv[i], "-c") && i + 1 < argc) budget = strtoull(argv[++i], nullptr, 0);
+		else if(!strcmp(argv[i], "-q") && i + 1 < argc) capacity = strtoull(argv[++i], nullptr, 0);
+		else if(!strcmp(argv[i], "-t") && i + 1 < argc) topology = argv[++i];
+		else if(!strcmp(argv[i], "-f") && i + 1 < argc) floppy = argv[++i];
+		else if(!strcmp(argv[i], "-s")) scaling = true;
+		else program = argv[i];
+	}
+
+	bool known = topology == "ring" || topology == "mesh" || topology == "star";
+	if(program.empty() && scaling) program = DCPU_PROGRAMS_DIR "/stream.dasm";
+
+	if(program.empty() || !known || count == 0 || capacity == 0 || (capacity & (capacity - 1)))
+		return printf("Usage:\t./dcpu-cluster [-n <nodes>] [-t ring|mesh|star] [-c <cycles per node>] [-q <ring capacity, power of 2>] [-f <disk image>] [-s] <program file>\n"
+			"\t-f: a floppy in every node's M35FD, one read-only mapping shared by all\n"
+			"\t-s: throughput scaling benchmark on 1, 2, 4... up to <nodes> nodes (default program: stream.dasm)\n");
+
+	std::string source;
+	if(!readFile(program, source)) { perror(program.c_str()); return 1; }
+	std::vector<uint16_t> image = isImage(program) ? loadImage(source) : std::vector<uint16_t>(Assembler(source));
+
+	std::shared_ptr<DiskImage> disk;
+	if(!floppy.empty() && !(disk = DiskImage::shared(floppy))) { perror(floppy.c_str()); return 1; }
+
+	if(!scaling)
+	{
+		Totals t = run(image, disk, count, topology, capacity, budget, true);
+		printf("%u nodes (%s): %.2f ms, %llu messages, %.3f M messages/s, %.2f emulated MHz total\n", count, topology.c_str(), t.ms,
+			(unsigned long long)t.received, (double)t.received / t.ms / 1e3, (double)t.cycles / t.ms / 1e3);
+		return 0;
+	}
+
+	printf("host threads: %u, topology: %s, %llu cycles per node\n", std::thread::hardware_concurrency(), topology.c_str(), (unsigned long long)budget);
+	printf("%6s %10s %14s %14s %12s\n", "nodes", "ms", "messages", "M msg/s", "speedup");
+
+	std::vector<unsigned> sizes;
+	for(unsigned n = 1; n < count; n *= 2) sizes.push_back(n);
+	sizes.push_back(count);
+
+	double base = 0.0;
+	for(unsigned n : sizes)
+	{
+		Totals t = run(image, disk, n, topology, capacity, budget, false);
+		double rate = (double)t.received / t.ms / 1e3;
+		if(n == 1) base = rate;
+
+		printf("%6u %10.2f %14llu %14.3f %11.2fx\n", n, t.ms, (unsigned long long)t.received, rate, base > 0.0 ? rate / base : 0.0);
+	}
+
+	return 0;
+}
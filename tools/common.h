@@ -0,0 +1,37 @@
+// Helpers shared by the command line tools
+#pragma once
+
+#include <cstdio>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+inline bool readFile(const std::string& path, std::string& out)
+{
+	struct stat info;
+	if(stat(path.c_str(), &info) < 0) return false;
+
+	FILE* file = fopen(path.c_str(), "rb");
+	if(!file) return false;
+
+	out.assign((size_t)info.st_size, '\0');
+	size_t n = fread(&out[0], 1, out.size(), file);
+	fclose(file);
+
+	return n == out.size();
+}
+
+// Raw memory images (*.bin) are little-endian words; anything else is assembled
+inline bool isImage(const std::string& path)
+{
+	return path.size() > 4 && path.compare(path.size() - 4, 4, ".bin") == 0;
+}
+
+inline std::vector<uint16_t> loadImage(const std::string& bytes)
+{
+	std::vector<uint16_t> image(0x10000);
+	for(size_t i = 0; i + 1 < bytes.size() && i / 2 < image.size(); i += 2)
+		image[i / 2] = (uint16_t)((uint8_t)bytes[i] | (uint8_t)bytes[i + 1] << 8);
+
+	return image;
+}
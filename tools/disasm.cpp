@@ -0,0 +1,73 @@
+// Bulk disassembler: produces listings of whole memory images
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "dcpu16.h"
+#include "assembler.h"
+#include "disassembler.h"
+#include "common.h"
+
+int main(int argc, char* argv[])
+{
+	uint32_t begin = 0, end = 0x10000;
+	const char* input = nullptr;
+	const char* output = nullptr;
+
+	for(int i = 1; i < argc; i++)
+	{
+		if(!strcmp(argv[i], "-o") && i + 1 < argc) output = argv[++i];
+		else if(!strcmp(argv[i], "-r") && i + 1 < argc)
+		{
+			char* colon;
+			begin = (uint32_t)strtoul(argv[++i], &colon, 0);
+			if(*colon == ':') end = (uint32_t)strtoul(colon + 1, nullptr, 0);
+		}
+		else input = argv[i];
+	}
+
+	if(!input || begin > end || end > 0x10000)
+		return printf("Usage:\t./dcpu-disasm [-o <listing file>] [-r <begin>:<end>] <program file | image.bin>\n");
+
+	std::string buff;
+	if(!readFile(input, buff)) { perror(input); return 1; }
+
+	std::vector<uint16_t> image;
+	std::unordered_map<std::string, sint32> labels;
+
+	if(isImage(input))
+		image = loadImage(buff);
+	else
+	{
+		Assembler as(buff);
+		labels = as.labels();
+		image = std::move(as);
+	}
+
+	FILE* file = output ? fopen(output, "wb") : stdout;
+	if(!file) { perror(output); return 1; }
+
+	auto start = std::chrono::steady_clock::now();
+
+	Disassembler disasm(image.data(), labels);
+	std::vector<char> buffer(std::max<size_t>(1 << 20, disasm.maxLine()));
+	size_t bytes = 0;
+
+	for(uint32_t pc = begin; pc < end; )
+	{
+		size_t n = disasm.list(pc, end, buffer.data(), buffer.size());
+		fwrite(buffer.data(), 1, n, file);
+		bytes += n;
+	}
+
+	if(output) fclose(file);
+	else fflush(file);
+
+	double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	fprintf(stderr, "%u words, %zu bytes of listing in %.3f ms (%.1f MB/s)\n", end - begin, bytes, s * 1e3, (double)bytes / s / 1e6);
+
+	return 0;
+}
@@ -0,0 +1,397 @@
+// Job server: runs short DCPU-16 programs on a pool of CPUs that are reset and reused between jobs
+//
+// Requests and responses are frames of little-endian fields, each preceded by its length in bytes (u32).
+// Request:  u32 id, u64 cycle budget (0: the server's), u16 result address, u16 result words, then the
+//           program image, one u16 per word, loaded at 0.
+// Response: u32 id, u8 status, u8 0, u16 pages written, u64 cycles, u32 microseconds from the request's
+//           arrival to its result, u16 registers A..IA, then the result words.
+// Frames on one connection are answered in order; connections run in parallel, as many as there are CPUs.
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "dcpu16.h"
+#include "assembler.h"
+#include "metrics.h"
+#include "common.h"
+
+typedef std::chrono::steady_clock HostClock;
+
+enum Status : uint8_t { HALTED, OUT_OF_CYCLES, ON_FIRE, BAD_REQUEST };
+
+static const size_t RequestHeader = 16, ResponseHeader = 44;
+static const size_t MaxRequest = RequestHeader + 2 * 0x10000;
+
+class Pool
+{
+	std::vector<std::unique_ptr<DCPU16>> cpus;
+	std::vector<DCPU16*> idle;
+	std::mutex lock;
+	std::condition_variable freed;
+
+public:
+	explicit Pool(size_t n)
+	{
+		for(size_t i = 0; i < n; i++)
+		{
+			cpus.emplace_back(new DCPU16(std::vector<uint16_t>()));
+			idle.push_back(cpus.back().get());
+		}
+	}
+
+	size_t size() const { return cpus.size(); }
+
+	DCPU16* acquire()
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		freed.wait(guard, [this]() { return !idle.empty(); });
+
+		DCPU16* cpu = idle.back();
+		idle.pop_back();
+		return cpu;
+	}
+
+	void release(DCPU16* cpu)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		idle.push_back(cpu);
+		freed.notify_one();
+	}
+};
+
+struct Stats
+{
+	Counter jobs, resetNs;
+	Histogram latency; // microseconds from a request's arrival to its result
+};
+
+static uint16_t get16(const uint8_t* p) { return (uint16_t)(p[0] | p[1] << 8); }
+static uint32_t get32(const uint8_t* p) { return (uint32_t)get16(p) | (uint32_t)get16(p + 2) << 16; }
+static uint64_t get64(const uint8_t* p) { return (uint64_t)get32(p) | (uint64_t)get32(p + 4) << 32; }
+
+static void put16(uint8_t* p, uint16_t v) { p[0] = (uint8_t)v; p[1] = (uint8_t)(v >> 8); }
+static void put32(uint8_t* p, uint32_t v) { put16(p, (uint16_t)v); put16(p + 2, (uint16_t)(v >> 16)); }
+static void put64(uint8_t* p, uint64_t v) { put32(p, (uint32_t)v); put32(p + 4, (uint32_t)(v >> 32)); }
+
+static bool readAll(int fd, void* data, size_t n)
+{
+	for(uint8_t* p = (uint8_t*)data; n; )
+	{
+		ssize_t got = read(fd, p, n);
+		if(got < 0 && errno == EINTR) continue;
+		if(got <= 0) return false;
+
+		p += got;
+		n -= (size_t)got;
+	}
+
+	return true;
+}
+
+static bool writeAll(int fd, const void* data, size_t n)
+{
+	for(const uint8_t* p = (const uint8_t*)data; n; )
+	{
+		ssize_t put = write(fd, p, n);
+		if(put < 0 && errno == EINTR) continue;
+		if(put <= 0) return false;
+
+		p += put;
+		n -= (size_t)put;
+	}
+
+	return true;
+}
+
+static bool readFrame(int fd, std::vector<uint8_t>& frame)
+{
+	uint8_t length[4];
+	if(!readAll(fd, length, 4) || get32(length) > MaxRequest) return false;
+
+	frame.resize(get32(length));
+	return readAll(fd, frame.data(), frame.size());
+}
+
+static bool writeFrame(int fd, const std::vector<uint8_t>& frame)
+{
+	uint8_t length[4];
+	put32(length, (uint32_t)frame.size());
+	return writeAll(fd, length, 4) && writeAll(fd, frame.data(), frame.size());
+}
+
+// Like dcpu-batch: a jump to itself is the customary way to stop
+static Status run(DCPU16& cpu, uint64_t budget)
+{
+	while(cpu.isRunning() && cpu.cycles() < budget)
+	{
+		uint16_t pc = cpu.registers()[PC];
+		if(cpu.step(budget) == 1 && cpu.registers()[PC] == pc) return HALTED;
+	}
+
+	return cpu.isRunning() ? OUT_OF_CYCLES : ON_FIRE;
+}
+
+// Answers frames from `in` on `out` until either side closes
+static void serve(int in, int out, Pool& pool, Stats& stats, uint64_t defaultBudget)
+{
+	std::vector<uint8_t> request, response;
+	std::vector<uint16_t> image;
+
+	while(readFrame(in, request))
+	{
+		auto arrival = HostClock::now();
+
+		bool valid = request.size() >= RequestHeader && request.size() % 2 == 0;
+		uint32_t id = request.size() >= 4 ? get32(&request[0]) : 0;
+		uint64_t budget = valid ? get64(&request[4]) : 0;
+		uint16_t address = valid ? get16(&request[12]) : 0, words = valid ? get16(&request[14]) : 0;
+
+		response.assign(ResponseHeader + 2 * (size_t)words, 0);
+		put32(&response[0], id);
+
+		if(!valid)
+			response[4] = BAD_REQUEST;
+		else
+		{
+			image.resize((request.size() - RequestHeader) / 2);
+			for(size_t i = 0; i < image.size(); i++)
+				image[i] = get16(&request[RequestHeader + 2 * i]);
+
+			DCPU16* cpu = pool.acquire();
+
+			auto t0 = HostClock::now();
+			cpu->reset(image);
+			stats.resetNs.add((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(HostClock::now() - t0).count());
+
+			response[4] = run(*cpu, budget ? budget : defaultBudget);
+			put16(&response[6], (uint16_t)cpu->dirtyPages());
+			put64(&response[8], cpu->cycles());
+			for(unsigned r = 0; r < 12; r++)
+				put16(&response[20 + 2 * r], cpu->registers()[r]);
+			for(unsigned i = 0; i < words; i++)
+				put16(&response[ResponseHeader + 2 * i], cpu->read((uint16_t)(address + i)));
+
+			pool.release(cpu);
+		}
+
+		uint64_t us = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(HostClock::now() - arrival).count();
+		put32(&response[16], (uint32_t)std::min<uint64_t>(us, UINT32_MAX));
+		stats.latency.record(us);
+		stats.jobs.add();
+
+		if(!writeFrame(out, response)) break;
+	}
+}
+
+static void report(const Stats& stats)
+{
+	uint64_t jobs = stats.jobs.get();
+	fprintf(stderr, "%llu jobs, latency (us) %s, reset %.2f us on average\n", (unsigned long long)jobs,
+		stats.latency.json().c_str(), jobs ? (double)stats.resetNs.get() / (double)jobs / 1e3 : 0.0);
+}
+
+static volatile sig_atomic_t stopping = 0;
+
+static void stop(int) { stopping = 1; }
+
+static int listenOn(const std::string& path)
+{
+	sockaddr_un addr = {};
+	addr.sun_family = AF_UNIX;
+	if(path.size() >= sizeof(addr.sun_path)) { errno = ENAMETOOLONG; return -1; }
+	memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(fd < 0) return -1;
+
+	unlink(path.c_str());
+	if(bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 64) < 0) { close(fd); return -1; }
+
+	return fd;
+}
+
+// Sends `count` copies of a job through serve() over a socket pair, one at a time, and checks every
+// answer against a DCPU16 of its own
+static int bench(const std::vector<uint16_t>& image, unsigned count, uint64_t budget, uint16_t address, uint16_t words)
+{
+	int fds[2];
+	if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) { perror("socketpair"); return 1; }
+
+	Pool pool(1);
+	Stats stats;
+	std::thread server([&]() { serve(fds[1], fds[1], pool, stats, budget); });
+
+	std::vector<uint8_t> request(RequestHeader + 2 * image.size()), response;
+	put64(&request[4], budget);
+	put16(&request[12], address);
+	put16(&request[14], words);
+	for(size_t i = 0; i < image.size(); i++)
+		put16(&request[RequestHeader + 2 * i], image[i]);
+
+	DCPU16 fresh(image);
+	std::vector<uint8_t> expected(ResponseHeader + 2 * (size_t)words, 0);
+	expected[4] = run(fresh, budget);
+	put64(&expected[8], fresh.cycles());
+	for(unsigned r = 0; r < 12; r++)
+		put16(&expected[20 + 2 * r], fresh.registers()[r]);
+	for(unsigned i = 0; i < words; i++)
+		put16(&expected[ResponseHeader + 2 * i], fresh.read((uint16_t)(address + i)));
+
+	std::vector<double> roundTrips;
+	unsigned wrong = 0;
+	for(unsigned n = 0; n < count; n++)
+	{
+		put32(&request[0], n);
+		put32(&expected[0], n);
+
+		auto t0 = HostClock::now();
+		if(!writeFrame(fds[0], request) || !readFrame(fds[0], response)) { fprintf(stderr, "connection lost\n"); break; }
+		roundTrips.push_back(std::chrono::duration<double, std::micro>(HostClock::now() - t0).count());
+
+		// Everything but the pages written and the timing must match
+		memcpy(&expected[6], &response[6], 2);
+		memcpy(&expected[16], &response[16], 4);
+		wrong += response != expected;
+	}
+
+	shutdown(fds[0], SHUT_WR);
+	server.join();
+	close(fds[0]);
+	close(fds[1]);
+
+	if(roundTrips.empty()) return 1;
+	std::sort(roundTrips.begin(), roundTrips.end());
+	auto at = [&](double q) { return roundTrips[std::min(roundTrips.size() - 1, (size_t)(q * (double)roundTrips.size()))]; };
+
+	printf("%zu jobs of %zu words, %llu cycles, %u pages written: round trip p50 %.1f us, p99 %.1f us, max %.1f us\n",
+		roundTrips.size(), image.size(), (unsigned long long)fresh.cycles(), (unsigned)get16(&response[6]), at(0.5), at(0.99), roundTrips.back());
+	fflush(stdout);
+	report(stats);
+	printf("%u of %zu results differ from a fresh CPU\n", wrong, roundTrips.size());
+
+	return wrong ? 1 : 0;
+}
+
+int main(int argc, char* argv[])
+{
+	unsigned poolSize = std::thread::hardware_concurrency(), benchJobs = 0;
+	uint64_t budget = 1000000;
+	std::string socketPath, program;
+	uint16_t address = 0, words = 0;
+
+	for(int i = 1; i < argc; i++)
+	{
+		if(!strcmp(argv[i], "-p") && i + 1 < argc) poolSize = (unsigned)atoi(argv[++i]);
+		else if(!strcmp(argv[i], "-c") && i + 1 < argc) budget = strtoull(argv[++i], nullptr, 0);
+		else if(!strcmp(argv[i], "-s") && i + 1 < argc) socketPath = argv[++i];
+		else if(!strcmp(argv[i], "-b") && i + 1 < argc) benchJobs = (unsigned)atoi(argv[++i]);
+		else if(!strcmp(argv[i], "-r") && i + 2 < argc) { address = (uint16_t)strtoul(argv[++i], nullptr, 0); words = (uint16_t)strtoul(argv[++i], nullptr, 0); }
+		else program = argv[i];
+	}
+
+	if(poolSize == 0) poolSize = 1;
+
+	if(benchJobs && program.empty())
+		return printf("Usage:\t./dcpu-server [-p <pool size>] [-c <default cycle budget>] [-s <unix socket path>]\n"
+			"\t./dcpu-server -b <jobs> [-c <cycle budget>] [-r <result address> <words>] <program file>\n"
+			"\tWithout -s, jobs are read from stdin and results written to stdout (see tools/server.cpp for the framing).\n"
+			"\t-b: round-trip latency benchmark of one job, run <jobs> times through a socket pair\n");
+
+	if(benchJobs)
+	{
+		std::string source;
+		if(!readFile(program, source)) { perror(program.c_str()); return 1; }
+		std::vector<uint16_t> image = isImage(program) ? loadImage(source) : std::vector<uint16_t>(Assembler(source));
+
+		// Trailing zeros are what a reset CPU holds anyway
+		while(!image.empty() && image.back() == 0) image.pop_back();
+
+		return bench(image, benchJobs, budget, address, words);
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+
+	Pool pool(poolSize);
+	Stats stats;
+
+	if(socketPath.empty())
+	{
+		serve(0, 1, pool, stats, budget);
+		report(stats);
+		return 0;
+	}
+
+	int listener = listenOn(socketPath);
+	if(listener < 0) { perror(socketPath.c_str()); return 1; }
+
+	// No SA_RESTART: SIGINT or SIGTERM must get accept() out of the way
+	struct sigaction action = {};
+	action.sa_handler = stop;
+	sigaction(SIGINT, &action, nullptr);
+	sigaction(SIGTERM, &action, nullptr);
+
+	fprintf(stderr, "%u CPUs, listening on %s\n", poolSize, socketPath.c_str());
+
+	// Connections run on threads of their own, detached; main() waits for the last one before returning
+	std::mutex lock;
+	std::condition_variable closed;
+	std::vector<int> clients;
+
+	while(!stopping)
+	{
+		int client = accept(listener, nullptr, nullptr);
+		if(client < 0)
+		{
+			// A signal, or a client that gave up, is nothing; anything else (out of descriptors, say)
+			// will not clear up at once, so say so and give it a moment instead of spinning
+			if(errno != EINTR && errno != ECONNABORTED)
+			{
+				perror("accept");
+				std::this_thread::sleep_for(std::chrono::milliseconds(100));
+			}
+			continue;
+		}
+
+		std::lock_guard<std::mutex> guard(lock);
+		clients.push_back(client);
+		std::thread([client, &pool, &stats, &lock, &closed, &clients, budget]()
+		{
+			serve(client, client, pool, stats, budget);
+
+			std::lock_guard<std::mutex> guard(lock);
+			clients.erase(std::find(clients.begin(), clients.end(), client));
+			close(client);
+			closed.notify_all();
+		}).detach();
+	}
+
+	close(listener);
+	unlink(socketPath.c_str());
+
+	// Jobs in progress finish; connections waiting for their next request are cut off
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		for(int client : clients)
+			shutdown(client, SHUT_RD);
+
+		closed.wait(guard, [&]() { return clients.empty(); });
+	}
+
+	report(stats);
+
+	return 0;
+}
@@ -0,0 +1,135 @@
+// Runs one program on many DCPU-16s in lockstep, each with a different input, and checks the results
+// against running every VM on its own
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "dcpu16.h"
+#include "assembler.h"
+#include "lockstep.h"
+#include "common.h"
+
+#ifndef DCPU_PROGRAMS_DIR
+#define DCPU_PROGRAMS_DIR "programs"
+#endif
+
+typedef std::chrono::steady_clock HostClock;
+
+static double since(HostClock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(HostClock::now() - start).count();
+}
+
+int main(int argc, char* argv[])
+{
+	size_t count = 1024;
+	uint64_t budget = 200000, wait = 1024;
+	std::string program, input = "input";
+	bool verify = true, avx2 = true;
+
+	for(int i = 1; i < argc; i++)
+	{
+		if(!strcmp(argv[i], "-n") && i + 1 < argc) count = strtoull(argv[++i], nullptr, 0);
+		else if(!strcmp(argv[i], "-c") && i + 1 < argc) budget = strtoull(argv[++i], nullptr, 0);
+		else if(!strcmp(argv[i], "-i") && i + 1 < argc) input = argv[++i];
+		else if(!strcmp(argv[i], "-w") && i + 1 < argc) wait = strtoull(argv[++i], nullptr, 0);
+		else if(!strcmp(argv[i], "-x")) avx2 = false;
+		else if(!strcmp(argv[i], "-q")) verify = false;
+		else if(argv[i][0] == '-') program.clear(), count = 0;
+		else program = argv[i];
+	}
+
+	if(program.empty() && count) program = DCPU_PROGRAMS_DIR "/sweep.dasm";
+
+	if(count == 0)
+		return printf("Usage:\t./dcpu-sweep [-n <VMs>] [-c <cycles per VM>] [-i <input label or address>] [-w <max wait>] [-x] [-q] [program file]\n"
+			"\tVM n starts with n in the input word (default: label \"input\"), runs for the given cycles, and is\n"
+			"\tcompared with a DCPU16 running the same (default program: sweep.dasm)\n"
+			"\t-w: steps a diverged VM may wait for the others before it finishes on the scalar core\n"
+			"\t-x: no AVX2, portable lanes only   -q: skip the scalar runs\n");
+
+	std::string source;
+	if(!readFile(program, source)) { perror(program.c_str()); return 1; }
+
+	std::vector<uint16_t> image;
+	long address = -1;
+	if(isImage(program))
+		image = loadImage(source);
+	else
+	{
+		Assembler assembler(source);
+		std::string name = input; // the assembler keeps labels in upper case
+		for(auto& c : name) c = (char)toupper(c);
+
+		auto label = assembler.labels().find(name);
+		if(label != assembler.labels().end()) address = label->second;
+		image = std::move(assembler);
+	}
+
+	if(address < 0)
+	{
+		char* rest;
+		address = strtol(input.c_str(), &rest, 0);
+		if(*rest || address < 0 || address > 0xFFFF) { fprintf(stderr, "%s: no label or address \"%s\"\n", program.c_str(), input.c_str()); return 1; }
+	}
+
+	Lockstep batch(image, count);
+	batch.useAvx2(avx2);
+	batch.setMaxWait(wait);
+	for(size_t vm = 0; vm < count; vm++)
+		batch.poke(vm, (uint16_t)address, (uint16_t)vm);
+
+	auto start = HostClock::now();
+	batch.run(budget);
+	double lockstepMs = since(start);
+
+	const Lockstep::Stats& stats = batch.statistics();
+	uint64_t total = stats.lanes + stats.scalar;
+
+	printf("%s: %zu VMs, %llu cycles each, %s lanes\n", program.c_str(), count, (unsigned long long)budget, batch.usingAvx2() ? "AVX2" : "portable");
+	printf("lockstep: %10.2f ms %14llu instructions %10.2f M instructions/s  (%.1f%% in lockstep, %.1f lanes per step, %llu peeled)\n",
+		lockstepMs, (unsigned long long)total, (double)total / lockstepMs / 1e3, total ? 100.0 * (double)stats.lanes / (double)total : 0.0,
+		stats.steps ? (double)stats.lanes / (double)stats.steps : 0.0, (unsigned long long)stats.peeled);
+
+	if(!verify) return 0;
+
+	unsigned mismatches = 0;
+	uint64_t scalarTotal = 0;
+	double scalarMs = 0.0;
+
+	for(size_t vm = 0; vm < count; vm++)
+	{
+		std::vector<uint16_t> own = image;
+		own.resize(0x10000);
+		own[(size_t)address] = (uint16_t)vm;
+
+		DCPU16 cpu(own);
+		uint64_t n = 0;
+
+		start = HostClock::now();
+		while(cpu.isRunning() && cpu.cycles() < budget)
+			n += cpu.step(budget);
+		scalarMs += since(start);
+		scalarTotal += n;
+
+		bool same = cpu.cycles() == batch.cyclesOf(vm) && n == batch.instructionsOf(vm);
+		for(unsigned r = 0; r < 12; r++)
+			same = same && cpu.registers()[r] == batch.registerOf(vm, r);
+		for(unsigned a = 0; a < 0x10000; a++)
+			same = same && cpu.read((uint16_t)a) == batch.peek(vm, (uint16_t)a);
+
+		if(!same && mismatches++ < 10)
+			printf("VM %zu differs: %llu cycles, %llu instructions, PC=%04X (scalar: %llu cycles, %llu instructions, PC=%04X)\n", vm,
+				(unsigned long long)batch.cyclesOf(vm), (unsigned long long)batch.instructionsOf(vm), batch.registerOf(vm, PC),
+				(unsigned long long)cpu.cycles(), (unsigned long long)n, cpu.registers()[PC]);
+	}
+
+	printf("scalar:   %10.2f ms %14llu instructions %10.2f M instructions/s\n", scalarMs, (unsigned long long)scalarTotal, (double)scalarTotal / scalarMs / 1e3);
+	printf("speedup %.2fx, %u of %zu VMs differ\n", scalarMs / lockstepMs, mismatches, count);
+
+	return mismatches ? 1 : 0;
+}
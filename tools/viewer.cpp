@@ -0,0 +1,80 @@
+// Reference viewer for a LEM1802 exported with SharedScreen: turns its frames into PNGs and hash lines
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "capture.h"
+#include "lem1802.h"
+#include "sharedscreen.h"
+
+typedef std::chrono::steady_clock HostClock;
+
+int main(int argc, char* argv[])
+{
+	uint64_t count = 1, every = 1;
+	unsigned timeoutMs = 5000;
+	std::string name, prefix;
+
+	for(int i = 1; i < argc; i++)
+	{
+		if(!strcmp(argv[i], "-n") && i + 1 < argc) count = strtoull(argv[++i], nullptr, 0);
+		else if(!strcmp(argv[i], "-e") && i + 1 < argc) every = strtoull(argv[++i], nullptr, 0);
+		else if(!strcmp(argv[i], "-o") && i + 1 < argc) prefix = argv[++i];
+		else if(!strcmp(argv[i], "-t") && i + 1 < argc) timeoutMs = (unsigned)atoi(argv[++i]);
+		else name = argv[i];
+	}
+
+	if(name.empty() || every == 0)
+		return printf("Usage:\t./dcpu-viewer [-n <frames, 0: until the emulator stops>] [-e <every n-th frame>] [-o <png prefix>] [-t <timeout ms>] <segment name>\n"
+			"\tPrints \"<frame> <cycle> <hash>\" for each frame taken, like dcpu-capture's hash log; with -o, also writes <prefix>NNNNNN.png.\n"
+			"\tGives up after <timeout> ms without a new frame (or without the segment).\n");
+
+	auto timeout = std::chrono::milliseconds(timeoutMs);
+	auto last = HostClock::now();
+
+	std::unique_ptr<SharedScreenView> view(SharedScreenView::open(name));
+	while(!view)
+	{
+		if(HostClock::now() - last > timeout) { fprintf(stderr, "%s: no LEM1802 segment\n", name.c_str()); return 1; }
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		view.reset(SharedScreenView::open(name));
+	}
+
+	ScreenState state;
+	std::vector<uint8_t> pixels(SCREEN_WIDTH * SCREEN_HEIGHT * 4), rgb;
+	uint64_t frame, cycle, next = 0, taken = 0;
+
+	last = HostClock::now();
+	while(count == 0 || taken < count)
+	{
+		if(!view->read(state, frame, cycle) || frame < next)
+		{
+			if(HostClock::now() - last > timeout) break;
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			continue;
+		}
+
+		last = HostClock::now();
+		next = frame + every;
+
+		LEM1802::rasterize(state, pixels.data());
+		toRgb(pixels.data(), rgb);
+		printf("%llu %llu %016llX\n", (unsigned long long)frame, (unsigned long long)cycle, (unsigned long long)frameHash(rgb));
+
+		if(!prefix.empty())
+		{
+			char number[32];
+			snprintf(number, sizeof(number), "%06llu.png", (unsigned long long)frame);
+			if(!writePng(prefix + number, rgb)) { perror((prefix + number).c_str()); return 1; }
+		}
+
+		taken++;
+	}
+
+	return taken ? 0 : 1;
+}